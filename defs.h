@@ -9,6 +9,8 @@
 #ifndef _DEFS_H_
 #define _DEFS_H_
 
+#include "keycodes.h"
+
 #define VERSION_STRING "v0.6 Feb 13 2010"
 
 #define set_bit(v,b)        v |= _BV(b)
@@ -33,17 +35,184 @@
 #define VSYNC_PIN     0
 #define SYNC_MASK     0b00000011
 
-#define TILE_WIDTH    6   /* must be 8 or less! */
-#define TILE_HEIGHT   8   /* must be a power of two! */
-#define TILE_HBIT     LOG2(TILE_HEIGHT)
+/* number of RAM-resident glyphs loadable with DECDLD */
+#define NUM_SOFT_GLYPHS 16
+
+/* Font. The Makefile defines FONT_6x8_FULL for the 256-glyph font
+ * (FONT=6x8x256), where all eight bits of a cell are the pattern ID and
+ * reverse video comes from ATTRMAP instead of bit 7. */
+#ifndef FONT_6x8_FULL
+#define FONT_6x8
+#endif
+
+/* Geometry. The Makefile overrides these for other GEOMETRY targets. */
+#ifndef TILE_WIDTH
+#define TILE_WIDTH    6   /* 6 to 8 */
+#endif
+#ifndef TILES_WIDE
 #define TILES_WIDE    54
+#endif
+#ifndef TILES_HIGH
 #define TILES_HIGH    24
+#endif
+#define TILE_HEIGHT   8   /* must be a power of two! */
+#define TILE_HBIT     LOG2(TILE_HEIGHT)
 #define NUM_TILES     (TILES_WIDE*TILES_HIGH)
 #define PIXELS_WIDE   (TILE_WIDTH*TILES_WIDE)
 #define PIXELS_HIGH   (TILE_HEIGHT*TILES_HIGH)
 #define NUM_LINES     PIXELS_HIGH
 
+#if TILE_WIDTH < 6 || TILE_WIDTH > 8
+#error TILE_WIDTH must be 6, 7 or 8; the renderer needs 5 pixels to fetch a tile
+#endif
+#if NUM_LINES > 255
+#error Too many rows; the renderer counts lines in one byte
+#endif
+
+/* The attribute map has a bit per cell for reverse video and, if the SRAM
+ * budget below has room for it (ATTR_BLINK), another for blink. The
+ * renderer loads a line's attribute bytes into registers during the
+ * horizontal retrace, folding in the blink bits on the blink phase. */
+#ifdef FONT_6x8_FULL
+#define ATTR_BYTES        ((TILES_WIDE+7)/8)
+#define SRAM_ATTR_PLANE   ((TILES_HIGH+1)*ATTR_BYTES)
+#define ATTR_LOAD_CYCLES  ((2+4*(ATTR_PLANES-1))*ATTR_BYTES+4)
+#define SRAM_ATTR         (ATTR_PLANES*SRAM_ATTR_PLANE)
+#else
+#define ATTR_LOAD_CYCLES  0
+#define SRAM_ATTR         0
+#endif
+
+/* Timing, in CPU cycles. A line is the pixels plus LINE_OVERHEAD cycles of
+ * setup and bookkeeping in video-asm.S plus the horizontal retrace: the
+ * attribute load and a delay loop of HDELAY_COUNT, rounded up to make at
+ * least HRETRACE_CYCLES. "make timing" checks each line is LINE_CYCLES
+ * long, so it fails if LINE_OVERHEAD is out of date. A frame is NUM_LINES
+ * lines, and the main loop needs at least MAIN_LOOP_CYCLES before the next
+ * frame starts. */
+#define PIXEL_CYCLES      5
+#define LINE_OVERHEAD     40
+#define HRETRACE_CYCLES   (3*(F_CPU/1000000)) /* 3 us for the beam to return */
+#define HDELAY_COUNT      ((HRETRACE_CYCLES-ATTR_LOAD_CYCLES+2)/3) /* 3 each */
+#define LINE_CYCLES       (PIXEL_CYCLES*PIXELS_WIDE+LINE_OVERHEAD+ \
+                           ATTR_LOAD_CYCLES+3*HDELAY_COUNT)
+#define MAIN_LOOP_CYCLES  4000
+#define FRAME_MIN_CYCLES  (LINE_CYCLES*NUM_LINES+MAIN_LOOP_CYCLES)
+
+/* optional statistics (see the Makefile) and the SRAM they take */
+#ifdef LATENCY_STATS
+#define LATENCY_STAGES    5
+#define LATENCY_BUCKETS   8
+#define SRAM_LATENCY      (LATENCY_STAGES*LATENCY_BUCKETS+10)
+#else
+#define SRAM_LATENCY      0
+#endif
+#ifdef PERF_STATS
+#define SRAM_PERF         11
+#else
+#define SRAM_PERF         0
+#endif
+#ifdef FRAMEPROF_STATS
+#define SRAM_FRAMEPROF    46
+#else
+#define SRAM_FRAMEPROF    0
+#endif
+#ifdef LINK_STATS
+#define SRAM_LINK         16
+#else
+#define SRAM_LINK         0
+#endif
+/* the reports sent to the host are queued for the transmit interrupt */
+#if defined(FRAMEPROF_STATS) || defined(LINK_STATS)
+#define REPLY_QUEUE
+#define REPLY_BUF_SIZE    128 /* a power of two */
+#define SRAM_REPLY        (REPLY_BUF_SIZE+2)
+#else
+#define SRAM_REPLY        0
+#endif
+#define SRAM_STATS        (SRAM_LATENCY+SRAM_PERF+SRAM_FRAMEPROF+SRAM_LINK+ \
+                           SRAM_REPLY)
+
+/* SRAM budget. SRAM_VARS covers the variables not counted here (about
+ * 240 bytes in the default build: the terminal state, the setup screen's
+ * profiles and EEPROM buffer, and the escape sequence parameters) and
+ * SRAM_STACK the stack, with the interrupts' pushes; what's left after the
+ * tilemap (plus its spare row), the attribute map, the soft glyphs and any
+ * statistics goes to the receive buffer. After linking, the Makefile
+ * checks that the variables really leave SRAM_STACK free. */
+#define SRAM_SIZE         2048
+#define SRAM_VARS         241
+#define SRAM_STACK        96
+#define SRAM_RESERVED     (SRAM_VARS+SRAM_STACK)
+#define RX_BUF_MAX        254
+#define SRAM_UNATTR       (SRAM_SIZE-(TILES_HIGH+1)*TILES_WIDE- \
+                           NUM_SOFT_GLYPHS*TILE_HEIGHT-SRAM_STATS- \
+                           SRAM_RESERVED)
+#define SRAM_FREE         (SRAM_UNATTR-SRAM_ATTR)
+/* The blink plane is only kept if the receive buffer doesn't shrink for it:
+ * not in the default 54x24 geometry, where the 256-glyph font has no
+ * blink attribute and SGR 5 isn't shown. */
+#if defined(FONT_6x8_FULL) && SRAM_UNATTR-2*SRAM_ATTR_PLANE >= RX_BUF_MAX
+#define ATTR_BLINK
+#define ATTR_PLANES       2
+#else
+#define ATTR_PLANES       1
+#endif
+#if SRAM_FREE < 32
+#error Geometry exceeds the SRAM budget: no room for the receive buffer
+#endif
+#if SRAM_FREE > RX_BUF_MAX
+#define RX_BUF_SIZE       RX_BUF_MAX
+#else
+#define RX_BUF_SIZE       SRAM_FREE
+#endif
+
+/* The frame timer (timer 1, 1/1024 prescaler) runs at REFRESH_HZ if the
+ * frame fits, and slower if it doesn't, down to MIN_REFRESH_HZ. */
+#define REFRESH_HZ        60
+#define MIN_REFRESH_HZ    40
+#define FRAME_PRESCALE    1024
+#define FRAME_TOP_NOMINAL ((F_CPU+FRAME_PRESCALE*REFRESH_HZ/2)/ \
+                           (FRAME_PRESCALE*REFRESH_HZ)-1)
+#define FRAME_TOP_MIN     ((FRAME_MIN_CYCLES+FRAME_PRESCALE-1)/ \
+                           FRAME_PRESCALE-1)
+#if FRAME_TOP_MIN > FRAME_TOP_NOMINAL
+#define FRAME_TOP         FRAME_TOP_MIN
+#else
+#define FRAME_TOP         FRAME_TOP_NOMINAL
+#endif
+#if (FRAME_TOP+1)*FRAME_PRESCALE*MIN_REFRESH_HZ > F_CPU
+#error Geometry exceeds the cycle budget: refresh would be below MIN_REFRESH_HZ
+#endif
+
+/* The keyboard frame (KB_FRAME_BYTES SPI bytes, 128 cycles each at
+ * F_CPU/16) is read in the background while the main loop runs, a byte
+ * per timer 0 interrupt (at F_CPU/8), KB_BYTE_CYCLES apart so the keyboard
+ * buffer has KB_BYTE_GAP_US to load the next one. Only the KB_PASS_BYTES
+ * whose interrupts land before the next frame are read per pass, less
+ * KB_START_CYCLES for starting the read and the last interrupt; a longer
+ * keyboard frame is finished on the next pass, so no interrupt jitters a
+ * line. A keyboard buffer out of step starts over after KB_RESYNC_MS of
+ * silence partway through a frame (keycodes.h), so the terminal leaves it
+ * alone for KB_RESYNC_PASSES. */
+#define KB_BYTE_GAP_US    40
+#define KB_FRAME_BYTES    (3+KB_NUM_ERRORS+KB_FRAME_MAX)
+#define KB_BYTE_CYCLES    ((128+KB_BYTE_GAP_US*(F_CPU/1000000)+7)/8*8)
+#define KB_START_CYCLES   200
+#define KB_PASS_BYTES     (((FRAME_TOP+1)*FRAME_PRESCALE- \
+                            LINE_CYCLES*NUM_LINES-KB_START_CYCLES)/ \
+                           KB_BYTE_CYCLES)
+#define KB_RESYNC_PASSES  (KB_RESYNC_MS*(F_CPU/1000)/ \
+                           ((FRAME_TOP+1)*FRAME_PRESCALE)+2)
+#if KB_BYTE_CYCLES/8 > 256
+#error KB_BYTE_GAP_US is too long for timer 0 to time
+#endif
+#if KB_PASS_BYTES < 1
+#error No time between frames to read the keyboard; raise MAIN_LOOP_CYCLES
+#endif
+
+/* the cursor blinks when this bit of the frame counter changes */
+#define BLINK_FRAME_BIT 5
 
-#define FONT_6x8
 
 #endif
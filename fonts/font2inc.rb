@@ -1,65 +1,147 @@
 #!/usr/bin/env ruby
 
-# Converts a font in a PGM image to an .byte assembler data
-# Each character cell must be 8x8 pixels
-# Input images may be 1024x8 pixels (128 characters)
-# or 2048x8 pixels (256 characters)
-# White (255,255,255) pixels are considered "on"
-# All others are considered "off"
+# Converts a font in a PGM image to .byte assembler data
+# Each character cell is 8 pixels wide and 8 high, left to right across the
+# image, so the image is 8 pixels high and 8 pixels wide per character, up
+# to 256 characters. Plain (P2) and raw (P5) PGM files are accepted.
+# Pixels at the image's maximum value (white) are "on"; all others are "off".
 # Result is written to stdout, and should be sent to an .inc file.
+#
+# Options:
+#   -l page   row-major, one 256-byte page per row (the default; this is the
+#             layout video-asm.S reads: ZH selects the row, ZL the character)
+#   -l row    row-major, packed: each row is as long as the font
+#   -l char   char-major: the eight rows of character 0, then character 1...
+#   -l dedup  char-major with identical glyphs stored once, after a table
+#             of 256 glyph numbers (FONT_GLYPHS) into the glyphs (FONT_ROWS);
+#             the table only pays for itself if more than 32 glyphs repeat
+#   -b lsb    the leftmost pixel in bit 0, for renderers that shift the
+#             slice out with lsr (the default)
+#   -b msb    the leftmost pixel in bit 7, for lsl
+#   -v        flip each character vertically
+#
+# The output defines the assembler symbol font_layout_<layout> and
+# font_<lsb|msb>_first, so the renderer can check it was given the layout
+# it reads. Flash usage of every layout is reported on stderr.
 # Example:
-#    ./font2inc.rb 6x8font.pgm > 6x8font.inc
+#    ./font2inc.rb -l page 6x8font.pgm > 6x8font.inc
 #
 # Matt Sarnoff (www.msarnoff.org)
 # November 10, 2009
 
-FLIPHORIZ = false
-FLIPVERT = false
+require 'optparse'
 
-# load pgm file
+LAYOUTS = %w(page row char dedup)
+
+layout = 'page'
+bitorder = 'lsb'
+flipvert = false
+OptionParser.new do |o|
+  o.banner = "usage: #{$0} [-l #{LAYOUTS.join('|')}] [-b lsb|msb] [-v] font.pgm"
+  o.on('-l LAYOUT', LAYOUTS) { |v| layout = v }
+  o.on('-b ORDER', %w(lsb msb)) { |v| bitorder = v }
+  o.on('-v') { flipvert = true }
+end.parse!
+if ARGV.length != 1 then
+  $stderr.puts "usage: #{$0} [-l #{LAYOUTS.join('|')}] [-b lsb|msb] [-v] font.pgm"
+  exit 1
+end
+
+# load pgm file: the header is magic, width, height and maximum value,
+# separated by whitespace and "#" comments, then the pixels
 pgmfile = ARGV[0]
-pixels = []
-File.open(pgmfile).each_line do |l|
-  if $. > 4 then
-    pixels << l.to_i
+data = File.binread(pgmfile)
+header = []
+pos = 0
+while header.length < 4
+  if data[pos] == '#' then
+    pos = data.index("\n", pos) || data.length
+  elsif data[pos] =~ /\s/ then
+    pos += 1
+  else
+    tok = data[pos..][/\A\S+/]
+    abort "#{pgmfile}: truncated header" if !tok
+    header << tok
+    pos += tok.length
   end
 end
+magic, width, height, maxval = header[0], *header[1..3].map(&:to_i)
+case magic
+when 'P2'
+  pixels = data[pos..].split.map(&:to_i)
+when 'P5'
+  abort "#{pgmfile}: 16-bit PGM files are not supported" if maxval > 255
+  pixels = data.byteslice(pos + 1, width * height).unpack('C*')
+else
+  abort "#{pgmfile}: not a PGM file"
+end
+if height != 8 || width % 8 != 0 || width > 2048 then
+  abort "#{pgmfile}: must be 8 pixels high and 8 pixels wide per character, " \
+        "up to 256 characters (this is #{width}x#{height})"
+end
+if pixels.length < width * height then
+  abort "#{pgmfile}: truncated"
+end
 
-width = pixels.length / 8
+# create bitmaps: one row byte per character per row
+numchars = width / 8
+bitmaps = Array.new(numchars) { Array.new(8, 0) }
+8.times do |row|
+  dst = flipvert ? 7 - row : row
+  numchars.times do |chr|
+    b = 0
+    px = pixels[row * width + chr * 8, 8]
+    8.times { |col| b |= 1 << col if px[col] == maxval }
+    b = ('%08b' % b).reverse.to_i(2) if bitorder == 'msb'
+    bitmaps[chr][dst] = b
+  end
+end
 
-if width != 1024 && width != 2048 then
-  puts "Input file must be 1024x8 or 2048x8 pixels, grayscale"
-  exit
+# flash usage per layout; the page layout needs the table aligned to 256
+# bytes, which costs up to 255 more
+glyphs = bitmaps.uniq
+padded = bitmaps + Array.new(256 - numchars) { Array.new(8, 0) }
+sizes = {
+  'page'  => 8 * 256,
+  'row'   => 8 * numchars,
+  'char'  => 8 * numchars,
+  'dedup' => 256 + 8 * (padded.uniq.length)
+}
+$stderr.puts "#{pgmfile}: #{numchars} characters, #{glyphs.length} distinct"
+LAYOUTS.each do |l|
+  $stderr.puts format("  %-6s %5d bytes%s%s", l, sizes[l],
+                      (l == 'page') ? ", 256-byte aligned" : "",
+                      (l == layout) ? "  <- written" : "")
+end
+if sizes['dedup'] >= sizes['char'] then
+  $stderr.puts "  dedup saves nothing: its 256-byte table costs more than the " \
+               "#{8 * (256 - padded.uniq.length)} bytes of repeated glyphs"
 end
 
-# create bitmaps
-bitmaps = Array.new(width/8, [0,0,0,0,0,0,0,0])
+def bytes(list)
+  list.each_slice(16).map { |s| ".byte " + s.join(',') }
+end
 
-p = 0
-row = 0
-col = 0
-chr = 0
-pixels.each do |val|
-  row = p.div width
-  col = p.modulo 8
-  chr = (p.modulo width).div 8
-  px = (val == 255) ? 1 : 0
-  
-  if FLIPHORIZ then
-    col = 7 - col
+out = ["font_layout_#{layout} = 1", "font_#{bitorder}_first = 1"]
+case layout
+when 'page', 'row'
+  chars = (layout == 'page') ? padded : bitmaps
+  8.times do |r|
+    out << "; row #{r}"
+    out.concat(bytes(chars.map { |b| b[r] }))
   end
-    
-  if FLIPVERT then
-    row = 7 - row
+when 'char'
+  bitmaps.each_with_index do |b, i|
+    out << "; character #{i}" if i % 16 == 0
+    out << ".byte " + b.join(',')
   end
-  
-  ch = bitmaps[chr].clone
-  ch[row] += (px << col)
-  bitmaps[chr] = ch
-  
-  p += 1
-end
-
-bitmaps.each do |b|
-  puts ".byte " + b.join(',')
+when 'dedup'
+  unique = padded.uniq
+  index = {}
+  unique.each_with_index { |b, i| index[b] = i }
+  out << "FONT_GLYPHS:"
+  out.concat(bytes(padded.map { |b| index[b] }))
+  out << "FONT_ROWS:"
+  unique.each { |b| out << ".byte " + b.join(',') }
 end
+puts out
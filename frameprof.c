@@ -0,0 +1,112 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * frameprof.c - frame budget profiler
+ */
+
+#include "frameprof.h"
+
+#ifdef FRAMEPROF_STATS
+
+#include <avr/io.h>
+#include <string.h>
+
+#include "defs.h"
+#include "report.h"
+
+typedef struct
+{
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+} phasestats_t;
+
+/* timer1 counts FRAME_PRESCALE cycles, which is FP_COARSE of our ticks */
+#define FP_COARSE (FRAME_PRESCALE/FP_TICK_CYCLES)
+
+static phasestats_t stats[FP_PHASES];
+static uint16_t frames;
+static uint16_t thisframe[FP_PHASES];
+static uint16_t lastcoarse;  /* TCNT1 at the end of the last phase */
+static uint8_t lastfine;     /* TCNT2 then */
+static uint8_t started;      /* last* are valid */
+
+void fp_init()
+{
+  TCCR2A = 0;
+  TCCR2B = _BV(CS21); /* clk/8, normal mode */
+}
+
+/* Timer1 only counts FRAME_PRESCALE cycles, so timer2 runs free at
+ * FP_TICK_CYCLES as well. Its 8 bits wrap every 2*FP_COARSE ticks, which
+ * is all it takes to pin down a time timer1 knows to within FP_COARSE:
+ * the fine count gives the time modulo 2*FP_COARSE, and the coarse count
+ * which of the candidates it is. */
+void fp_mark(uint8_t phase)
+{
+  uint8_t fine = TCNT2;
+  uint16_t coarse = TCNT1;
+  uint16_t c;
+  int8_t d;
+  uint8_t i;
+
+  /* timer1 starts over every frame; a phase that crossed the start of a
+   * frame (waiting for it, or a main loop that overran) ends lower */
+  c = coarse - lastcoarse;
+  if (coarse < lastcoarse)
+    c += FRAME_TOP+1;
+  c *= FP_COARSE;
+  d = (uint8_t)(fine - lastfine - c);
+  thisframe[phase] = (d < 0 && c < (uint8_t)-d) ? 0 : c + d;
+  lastcoarse = coarse;
+  lastfine = fine;
+
+  if (phase != FP_WAIT)
+    return;
+  if (!started) /* the first frame's wait began at an unknown time */
+  {
+    started = 1;
+    return;
+  }
+
+  /* keep the averages going by halving the sums before frames overflows */
+  if (frames == 0xFFFF)
+  {
+    frames >>= 1;
+    for (i = 0; i < FP_PHASES; i++)
+      stats[i].sum >>= 1;
+  }
+  frames++;
+  for (i = 0; i < FP_PHASES; i++)
+  {
+    uint16_t t = thisframe[i];
+    if (frames == 1 || t < stats[i].min) stats[i].min = t;
+    if (t > stats[i].max) stats[i].max = t;
+    stats[i].sum += t;
+  }
+}
+
+void fp_report()
+{
+  uint8_t i;
+  reply_start(93);
+  reply_num((FRAME_TOP+1)*FP_COARSE);
+  reply_num(frames);
+  for (i = 0; i < FP_PHASES; i++)
+  {
+    reply_num((frames) ? stats[i].min : 0);
+    reply_num((frames) ? stats[i].sum/frames : 0);
+    reply_num(stats[i].max);
+  }
+  reply_end();
+}
+
+void fp_reset()
+{
+  memset(stats, 0, sizeof(stats));
+  frames = 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * frameprof.h - frame budget profiler
+ *
+ * main() marks the end of each phase of a frame: drawing it
+ * (video_output_frame), the main loop, polling the keyboard, and waiting
+ * for the next frame, which is what's left over. The minimum, average and
+ * maximum of each are sent to the host, in FP_TICK_CYCLES CPU cycles, in
+ * answer to "ESC [ ? 93 n":
+ *   ESC [ ? 93 ; frame period ; frames ;
+ *     draw min ; avg ; max ; loop min ; avg ; max ;
+ *     keyboard min ; avg ; max ; wait min ; avg ; max n
+ * "ESC [ ? 94 n" starts again. Built in only when FRAMEPROF_STATS is
+ * defined (the Makefile's FRAMEPROF option); otherwise these calls compile
+ * to nothing.
+ */
+
+#ifndef _FRAMEPROF_H_
+#define _FRAMEPROF_H_
+
+#include <stdint.h>
+
+/* phases of a frame; waiting for the next frame ends it */
+#define FP_DRAW     0
+#define FP_LOOP     1
+#define FP_KEYBOARD 2
+#define FP_WAIT     3
+#define FP_PHASES   4
+
+/* the unit of the report: timer2's prescaler */
+#define FP_TICK_CYCLES  8
+
+#ifdef FRAMEPROF_STATS
+
+/* Start timer2; call before the first fp_mark() */
+void fp_init();
+
+/* The phase ended */
+void fp_mark(uint8_t phase);
+
+/* Send the report to the host */
+void fp_report();
+
+/* Clear the statistics */
+void fp_reset();
+
+#else
+#define fp_init()
+#define fp_mark(phase)
+#define fp_report()
+#define fp_reset()
+#endif
+
+#endif
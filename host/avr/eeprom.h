@@ -0,0 +1,26 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/avr/eeprom.h - EEPROM for the host build, kept in host_eeprom[]
+ * (host/shim.c). Writes complete immediately.
+ */
+
+#ifndef _HOST_AVR_EEPROM_H_
+#define _HOST_AVR_EEPROM_H_
+
+#include <avr/io.h>
+#include <stddef.h>
+
+extern uint8_t host_eeprom[E2END+1];
+
+#define eeprom_is_ready()   1
+#define eeprom_busy_wait()  do { } while (0)
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+uint16_t eeprom_read_word(const uint16_t *addr);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+
+#endif
@@ -0,0 +1,19 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/avr/interrupt.h - interrupt handlers become plain functions, which
+ * the host calls when it wants to
+ */
+
+#ifndef _HOST_AVR_INTERRUPT_H_
+#define _HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define ISR(vector) void vector(void)
+#define sei()
+#define cli()
+
+#endif
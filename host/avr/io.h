@@ -0,0 +1,63 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/avr/io.h - ATmega328P registers for the host build
+ *
+ * Only the registers the terminal core uses are here. They are plain
+ * variables in host/shim.c, so a read returns the last value written.
+ */
+
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit)            ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)          (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+
+extern volatile uint8_t DDRB, DDRC, DDRD, PORTB, PORTC, PORTD, PINB, PINC, PIND;
+extern volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+extern volatile uint16_t OCR1A, TCNT1;
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L, UDR0;
+
+/* TCCR1B */
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+/* TCCR2B */
+#define CS21    1
+
+/* TIFR1 */
+#define OCF1A   1
+
+/* UCSR0A */
+#define RXC0    7
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define U2X0    1
+
+/* UCSR0B */
+#define RXCIE0  7
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+
+/* UCSR0C */
+#define UPM01   5
+#define UPM00   4
+#define USBS0   3
+#define UCSZ01  2
+#define UCSZ00  1
+
+#define E2END   0x3FF
+
+#endif
@@ -0,0 +1,9 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/avr/sfr_defs.h - everything is in host/avr/io.h
+ */
+
+#include <avr/io.h>
@@ -0,0 +1,52 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/host.h - the terminal core built for the host
+ *
+ * "make host" compiles video.c, termconfig.c, terminal.c, latency.c and
+ * perf.c against the headers in host/ instead of avr-libc's, with host/shim.c
+ * standing in for main.c and video-asm.S, into host/libterminal.a. Link
+ * it into a host program to run bytes through the escape sequence parser
+ * and video routines and look at the result in TILEMAP, or to profile
+ * them.
+ *
+ * Programs using it must be compiled with the library's flags ($(HOSTCOMPILE)
+ * in the Makefile), so they agree on F_CPU and the geometry.
+ *
+ * TILEMAP[y] is screen row y while no smooth scroll is in progress. Cells
+ * hold character codes, with bit 7 set for reverse video; the cell under
+ * a visible cursor has bit 7 flipped. With FONT=6x8x256, cells hold all
+ * eight bits of the character, and reverse video and the cursor are the
+ * bits of ATTRMAP[y][n][0], most significant bit leftmost (see video.c).
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "avr/io.h"
+#include "../defs.h"
+
+extern char TILEMAP[TILES_HIGH+1][TILES_WIDE];
+#ifdef FONT_6x8_FULL
+extern uint8_t ATTRMAP[TILES_HIGH+1][ATTR_BYTES][ATTR_PLANES];
+#endif
+extern uint16_t frame;
+
+/* EEPROM contents, erased to start with. Set them before host_setup() to
+ * start with a saved configuration. */
+extern uint8_t host_eeprom[E2END+1];
+
+/* Start the terminal the way main() does */
+void host_setup();
+
+/* Pass bytes to receive_char() as if they had come from the serial port */
+void host_receive(const uint8_t *data, size_t len);
+
+/* Run the main loop once, as after a frame, and count the frame */
+void host_frame();
+
+#endif
@@ -0,0 +1,89 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/shim.c - what the host build needs from main.c, video-asm.S and the
+ * hardware
+ */
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <string.h>
+
+#include "host.h"
+#include "../video.h"
+
+extern void app_setup();
+extern uint8_t app_main_loop();
+extern void receive_char(uint8_t c);
+
+volatile uint8_t DDRB, DDRC, DDRD, PORTB, PORTC, PORTD, PINB, PINC, PIND;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1;
+volatile uint16_t OCR1A, TCNT1;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L, UDR0;
+
+uint8_t host_eeprom[E2END+1] = { [0 ... E2END] = 0xFF };
+
+/* from video-asm.S and main.c */
+uint8_t SOFTGLYPHS[TILE_HEIGHT][NUM_SOFT_GLYPHS];
+uint16_t frame;
+uint8_t kbsettings;
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+  return host_eeprom[(size_t)addr & E2END];
+}
+
+uint16_t eeprom_read_word(const uint16_t *addr)
+{
+  size_t a = (size_t)addr;
+  return eeprom_read_byte((const uint8_t *)a) |
+         eeprom_read_byte((const uint8_t *)(a+1)) << 8;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+  uint8_t *d = dst;
+  size_t a = (size_t)src;
+  while (n--)
+    *d++ = eeprom_read_byte((const uint8_t *)a++);
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+  host_eeprom[(size_t)addr & E2END] = value;
+}
+
+void host_setup()
+{
+  /* the transmitter is always ready */
+  UCSR0A = _BV(UDRE0);
+
+  video_setup();
+  app_setup();
+  video_start();
+  frame = 0;
+}
+
+void host_receive(const uint8_t *data, size_t len)
+{
+  while (len--)
+    receive_char(*data++);
+}
+
+#ifdef REPLY_QUEUE
+extern void USART_UDRE_vect(void);
+#endif
+
+void host_frame()
+{
+  app_main_loop();
+#ifdef REPLY_QUEUE
+  /* the transmitter is always ready, so queued replies go at once */
+  while (UCSR0B & _BV(UDRIE0))
+    USART_UDRE_vect();
+#endif
+  frame++;
+}
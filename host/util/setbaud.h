@@ -0,0 +1,19 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * host/util/setbaud.h - UBRR values for BAUD, as in avr-libc but without
+ * the tolerance check and U2X. Like the real one, it has no include guard;
+ * it is included again after each change to BAUD.
+ */
+
+#undef UBRR_VALUE
+#undef UBRRL_VALUE
+#undef UBRRH_VALUE
+#undef USE_2X
+
+#define UBRR_VALUE  ((F_CPU + 8UL*BAUD) / (16UL*BAUD) - 1UL)
+#define UBRRL_VALUE (UBRR_VALUE & 0xff)
+#define UBRRH_VALUE (UBRR_VALUE >> 8)
+#define USE_2X      0
@@ -0,0 +1,75 @@
+/* PS/2 keyboard buffer and decoder
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * keylookup.h - scancode to keycode lookup in the tables from keytables.h
+ *
+ * The base table has an entry for every scancode. The shifted and extended
+ * tables only store the entries that don't follow a rule (shifted letters
+ * are upper case, other shifted keys are unchanged, extended keys are 0).
+ * A bitmap marks which scancodes have an entry, and the entry's index is
+ * the number of marked scancodes before it: a running count per bitmap
+ * byte plus the bits set below it in that byte.
+ */
+
+#ifndef _KEYLOOKUP_H_
+#define _KEYLOOKUP_H_
+
+#include <stdint.h>
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#elif !defined(pgm_read_byte)  /* unless host/avr/pgmspace.h has them */
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#endif
+
+#include "keytables.h"
+
+#define KEY_NO_ENTRY 0xFF
+
+/* number of bits set in each nibble */
+static const uint8_t nibble_bits[16] PROGMEM = {
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+/* Index of a scancode's entry in a packed table, or KEY_NO_ENTRY */
+static inline uint8_t key_index(const uint8_t *bits, const uint8_t *rank,
+                                uint8_t code)
+{
+  uint8_t b = pgm_read_byte(bits + (code >> 3));
+  uint8_t mask = 1 << (code & 7);
+  if (!(b & mask))
+    return KEY_NO_ENTRY;
+  b &= mask-1;
+  return pgm_read_byte(rank + (code >> 3)) +
+         pgm_read_byte(nibble_bits + (b & 15)) +
+         pgm_read_byte(nibble_bits + (b >> 4));
+}
+
+/* Keycode for a scancode (at most KEY_MAX_CODE) given the shift/ctrl state
+ * (bits 0-1 shift, bits 2-3 ctrl) and whether it followed E0 or E1 */
+static inline uint8_t key_lookup(uint8_t code, uint8_t mods, uint8_t extended)
+{
+  uint8_t chr, i;
+  if (extended)
+  {
+    i = key_index(key_ext_bits, key_ext_rank, code);
+    return (i == KEY_NO_ENTRY) ? 0 : pgm_read_byte(key_ext_vals + i);
+  }
+
+  chr = pgm_read_byte(key_base + code);
+  if (mods & 0b1100) // ctrl
+    return chr & 31;
+  if (mods & 0b0011) // shift
+  {
+    i = key_index(key_shift_bits, key_shift_rank, code);
+    if (i != KEY_NO_ENTRY)
+      return pgm_read_byte(key_shift_vals + i);
+    if (chr >= 'a' && chr <= 'z')
+      return chr - 'a' + 'A';
+  }
+  return chr;
+}
+
+#endif
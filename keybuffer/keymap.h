@@ -0,0 +1,87 @@
+/* PS/2 keyboard buffer and decoder
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * keymap.h - scancode set 2 to keycode tables, one entry per scancode
+ *
+ * These aren't compiled into the firmware. tools/keytables.rb packs them
+ * into keytables.h, and tools/keytest.c checks the packed tables against
+ * them. Edit these, then run "make keytables.h keytest".
+ */
+
+#ifndef _KEYMAP_H_
+#define _KEYMAP_H_
+
+#include "keycodes.h"
+
+#define ESC K_ESC
+#define CLK K_CAPSLK
+#define NLK K_NUMLK
+#define SLK K_SCRLK
+#define F1  K_F1
+#define F2  K_F2
+#define F3  K_F3
+#define F4  K_F4
+#define F5  K_F5
+#define F6  K_F6
+#define F7  K_F7
+#define F8  K_F8
+#define F9  K_F9
+#define F10 K_F10
+#define F11 K_F11
+#define F12 K_F12
+#define INS K_INS
+#define DEL K_DEL
+#define HOM K_HOME
+#define END K_END
+#define PGU K_PGUP
+#define PGD K_PGDN
+#define ARL K_LEFT
+#define ARR K_RIGHT
+#define ARU K_UP
+#define ARD K_DOWN
+#define PRS K_PRTSC
+#define BRK K_BREAK
+
+static char codetable[] PROGMEM = {
+//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','`', 0,
+0,   0,   0,   0,   0,   'q', '1', 0,   0,   0,   'z', 's', 'a', 'w', '2', 0,
+0,   'c', 'x', 'd', 'e', '4', '3', 0,   0,   ' ', 'v', 'f', 't', 'r', '5', 0,
+0,   'n', 'b', 'h', 'g', 'y', '6', 0,   0,   0,   'm', 'j', 'u', '7', '8', 0,
+0,   ',', 'k', 'i', 'o', '0', '9', 0,   0,   '.', '/', 'l', ';', 'p', '-', 0,
+0,   0,   '\'',0,   '[', '=', 0,   0,   CLK, 0,   '\n',']', 0,   '\\',0,   0,
+0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
+'0', '.', '2', '5', '6', '8', ESC,  NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
+0,   0,   0,   F7
+};
+
+static char codetable_shifted[] PROGMEM = {
+//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','~', 0,
+0,   0,   0,   0,   0,   'Q', '!', 0,   0,   0,   'Z', 'S', 'A', 'W', '@', 0,
+0,   'C', 'X', 'D', 'E', '$', '#', 0,   0,   ' ', 'V', 'F', 'T', 'R', '%', 0,
+0,   'N', 'B', 'H', 'G', 'Y', '^', 0,   0,   0,   'M', 'J', 'U', '&', '*', 0,
+0,   '<', 'K', 'I', 'O', ')', '(', 0,   0,   '>', '?', 'L', ':', 'P', '_', 0,
+0,   0,   '"', 0,   '{', '+', 0,   0,   CLK, 0,   '\n','}', 0,   '|', 0,   0,
+0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
+'0', '.', '2', '5', '6', '8', ESC, NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
+0,   0,   0,   F7
+};
+
+// codes that follow E0 or E1
+static char codetable_extended[] PROGMEM = {
+//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+0,   0,   PRS, 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '/', 0,   0,   0,   0,   0,
+0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\n',0,   0,   0,   0,   0,
+0,   0,   0,   0,   0,   0,   0,   0,   0,   END, 0,   ARL, HOM, 0,   0,   0,
+INS, DEL, ARD, '5', ARR, ARU, 0,   BRK, 0,   0,   PGD, 0,   PRS, PGU, 0,   0,
+0,   0,   0,   0
+};
+
+#endif
@@ -0,0 +1,41 @@
+/* Generated by tools/keytables.rb from keymap.h. Do not edit. */
+/* 237 bytes; the unpacked tables are 396 bytes */
+
+#define KEY_MAX_CODE 0x83
+
+static const uint8_t key_base[132] PROGMEM = {
+  0x00, 0x89, 0x00, 0x85, 0x83, 0x81, 0x82, 0x8C, 0x00, 0x8A, 0x88, 0x86, 0x84, 0x09, 0x60, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x71, 0x31, 0x00, 0x00, 0x00, 0x7A, 0x73, 0x61, 0x77, 0x32, 0x00,
+  0x00, 0x63, 0x78, 0x64, 0x65, 0x34, 0x33, 0x00, 0x00, 0x20, 0x76, 0x66, 0x74, 0x72, 0x35, 0x00,
+  0x00, 0x6E, 0x62, 0x68, 0x67, 0x79, 0x36, 0x00, 0x00, 0x00, 0x6D, 0x6A, 0x75, 0x37, 0x38, 0x00,
+  0x00, 0x2C, 0x6B, 0x69, 0x6F, 0x30, 0x39, 0x00, 0x00, 0x2E, 0x2F, 0x6C, 0x3B, 0x70, 0x2D, 0x00,
+  0x00, 0x00, 0x27, 0x00, 0x5B, 0x3D, 0x00, 0x00, 0x80, 0x00, 0x0A, 0x5D, 0x00, 0x5C, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x31, 0x00, 0x34, 0x37, 0x00, 0x00, 0x00,
+  0x30, 0x2E, 0x32, 0x35, 0x36, 0x38, 0x1B, 0x97, 0x8B, 0x2B, 0x33, 0x2D, 0x2A, 0x39, 0x98, 0x00,
+  0x00, 0x00, 0x00, 0x87
+};
+
+static const uint8_t key_shift_bits[17] PROGMEM = {
+  0x00, 0x40, 0x40, 0x40, 0x60, 0x40, 0x40, 0x60, 0x62, 0x56, 0x34, 0x28, 0x00, 0x00, 0x00, 0x00,
+  0x00
+};
+static const uint8_t key_shift_rank[17] PROGMEM = {
+  0x00, 0x00, 0x01, 0x02, 0x03, 0x05, 0x06, 0x07, 0x09, 0x0C, 0x10, 0x13, 0x15, 0x15, 0x15, 0x15,
+  0x15
+};
+static const uint8_t key_shift_vals[21] PROGMEM = {
+  0x7E, 0x21, 0x40, 0x24, 0x23, 0x25, 0x5E, 0x26, 0x2A, 0x3C, 0x29, 0x28, 0x3E, 0x3F, 0x3A, 0x5F,
+  0x22, 0x7B, 0x2B, 0x7D, 0x7C
+};
+
+static const uint8_t key_ext_bits[17] PROGMEM = {
+  0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x04, 0x00, 0x1A, 0xBF, 0x34,
+  0x00
+};
+static const uint8_t key_ext_rank[17] PROGMEM = {
+  0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x03, 0x03, 0x06, 0x0D,
+  0x10
+};
+static const uint8_t key_ext_vals[16] PROGMEM = {
+  0x99, 0x2F, 0x0A, 0x94, 0x8E, 0x93, 0x91, 0x92, 0x8F, 0x35, 0x90, 0x8D, 0x9A, 0x96, 0x99, 0x95
+};
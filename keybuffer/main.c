@@ -5,112 +5,139 @@
  *
  * Reads scancodes from a PS/2 keyboard, decodes them to ASCII values
  * (or values greater than 0x80 for special keys) and stores them in a buffer.
- * A host microcontroller can then read the keypresses synchronously via SPI.
+ * A host microcontroller can then read the keypresses via SPI.
  *
  * Pins:
  *   PB3 (pin 2) to PS/2 data line
  *   PB4 (pin 3) to PS/2 clock line
  *   PB2 (pin 7) to SPI SCK line
  *   PB1 (pin 6) to SPI MISO line
+ *   PB0 (pin 5) to SPI MOSI line, for the repeat settings (optional)
  *
- * To read a keypress, send any byte on the SPI bus.
- * The first keycode in the queue will be dequeued and sent to the master.
- * If there are no keycodes in the buffer, 0 will be sent to the master.
- * 
- * Caps lock and the keyboard LEDs are not supported.
- * (Sorry, internet forum posters.)
+ * To read keypresses, the master clocks out a count byte, and if it is
+ * nonzero, a status byte and that many keycodes (see keycodes.h), and
+ * sends the key repeat settings while the count byte goes out.
+ * Each byte is loaded into the shift register as soon as the previous one
+ * has gone out, so the master only has to leave a short gap between bytes.
+ * The count byte waits in the shift register until the master polls; once
+ * it has gone out, the master reads the rest of the frame over one or more
+ * polls. If it goes quiet partway through for KB_RESYNC_MS
+ * (SPI_TIMEOUT_TICKS), the next frame starts over with a count byte.
+ *
+ * PS/2 frames with a bad start, parity or stop bit are dropped, and a frame
+ * whose clock stops for PS2_TIMEOUT_TICKS is abandoned, so a glitch costs
+ * at most one scancode. Errors are counted and reported to the master.
+ * The lost scancode may have been the release of a held key (or its F0
+ * prefix), so a dropped frame also stops that key repeating.
+ *
+ * Key repeat is generated here rather than by the keyboard: the keyboard's
+ * own typematic make codes are ignored, and the held key is queued again
+ * after REPEAT_DELAY_TICKS and then every repeatrate ticks. The master
+ * sets the rate, and can have held arrow keys repeated arrowbatch at a time
+ * at the same rate on average; the keys of a batch arrive in one frame,
+ * which the master can send to the host as a single counted cursor
+ * movement. Until it does, or if MOSI isn't connected, keys repeat one at
+ * a time every REPEAT_RATE_TICKS.
+ *
+ * Caps lock is handled here and lights its LED. Num lock is passed to the
+ * master (which uses it to enter setup); the keypad always sends digits,
+ * so its LED stays on. LED and typematic commands are sent to the keyboard
+ * from the interrupts, a bit per clock edge, so nothing waits on them.
  */
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 #include <string.h>
 
 #include "keycodes.h"
-
-#define ESC K_ESC
-#define CLK K_CAPSLK
-#define NLK K_NUMLK
-#define SLK K_SCRLK
-#define F1  K_F1
-#define F2  K_F2
-#define F3  K_F3
-#define F4  K_F4
-#define F5  K_F5
-#define F6  K_F6
-#define F7  K_F7
-#define F8  K_F8
-#define F9  K_F9
-#define F10 K_F10
-#define F11 K_F11
-#define F12 K_F12
-#define INS K_INS
-#define DEL K_DEL
-#define HOM K_HOME
-#define END K_END
-#define PGU K_PGUP
-#define PGD K_PGDN
-#define ARL K_LEFT
-#define ARR K_RIGHT
-#define ARU K_UP
-#define ARD K_DOWN
-#define PRS K_PRTSC
-#define BRK K_BREAK
-
-static char codetable[] PROGMEM = {
-//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','`', 0,
-0,   0,   0,   0,   0,   'q', '1', 0,   0,   0,   'z', 's', 'a', 'w', '2', 0,
-0,   'c', 'x', 'd', 'e', '4', '3', 0,   0,   ' ', 'v', 'f', 't', 'r', '5', 0,
-0,   'n', 'b', 'h', 'g', 'y', '6', 0,   0,   0,   'm', 'j', 'u', '7', '8', 0,
-0,   ',', 'k', 'i', 'o', '0', '9', 0,   0,   '.', '/', 'l', ';', 'p', '-', 0,
-0,   0,   '\'',0,   '[', '=', 0,   0,   CLK, 0,   '\n',']', 0,   '\\',0,   0,
-0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
-'0', '.', '2', '5', '6', '8', ESC,  NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
-0,   0,   0,   F7
-};
-
-static char codetable_shifted[] PROGMEM = {
-//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-0,   F9,  0,   F5,  F3,  F1,  F2,  F12, 0,   F10, F8,  F6,  F4,  '\t','~', 0,
-0,   0,   0,   0,   0,   'Q', '!', 0,   0,   0,   'Z', 'S', 'A', 'W', '@', 0,
-0,   'C', 'X', 'D', 'E', '$', '#', 0,   0,   ' ', 'V', 'F', 'T', 'R', '%', 0,
-0,   'N', 'B', 'H', 'G', 'Y', '^', 0,   0,   0,   'M', 'J', 'U', '&', '*', 0,
-0,   '<', 'K', 'I', 'O', ')', '(', 0,   0,   '>', '?', 'L', ':', 'P', '_', 0,
-0,   0,   '"', 0,   '{', '+', 0,   0,   CLK, 0,   '\n','}', 0,   '|', 0,   0,
-0,   0,   0,   0,   0,   0,   '\b',0,   0,   '1', 0,   '4', '7', 0,   0,   0,
-'0', '.', '2', '5', '6', '8', ESC, NLK, F11, '+', '3', '-', '*', '9', SLK, 0,
-0,   0,   0,   F7
-};
-
-// codes that follow E0 or E1
-static char codetable_extended[] PROGMEM = {
-//   1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-0,   0,   PRS, 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
-0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '/', 0,   0,   0,   0,   0,
-0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\n',0,   0,   0,   0,   0,
-0,   0,   0,   0,   0,   0,   0,   0,   0,   END, 0,   ARL, HOM, 0,   0,   0,
-INS, DEL, ARD, '5', ARR, ARU, 0,   BRK, 0,   0,   PGD, 0,   PRS, PGU, 0,   0,
-0,   0,   0,   0
-};
+#include "ps2rx.h"
+#include "keylookup.h"
 
 /* keyboard state */
 int8_t keyup;
 int8_t extended;
-int8_t bitcount;
-uint8_t scancode;
+ps2rx_t ps2;
 int8_t mods;
+uint8_t ps2quiet;
+uint8_t kberrors[KB_NUM_ERRORS];
+uint8_t errorschanged;
+
+/* ticks without a clock edge before abandoning a partial frame */
+#define PS2_TIMEOUT_TICKS 2
+
+/* lock state and LEDs */
+#define LED_SCROLL  0x01
+#define LED_NUM     0x02
+#define LED_CAPS    0x04
+uint8_t leds;
+
+/* host-to-device commands, sent when the receiver is idle */
+#define CMD_TYPEMATIC 0x01
+#define CMD_LEDS      0x02
+#define TYPEMATIC     0x7F  /* slowest: 1 s delay, 2 keys/s; we repeat */
+#define ACK_TIMEOUT_TICKS 25
+#define MAX_RESENDS   3
+uint8_t cmdpending;   // CMD_* bits
+uint8_t txbytes[2];   // command and argument being sent
+uint8_t txleft;       // bytes of txbytes not yet acknowledged
+uint8_t txresends;
+uint8_t ackticks;     // nonzero while waiting for the keyboard's FA
+
+/* transmitter state */
+#define TX_IDLE     0
+#define TX_INHIBIT  1 /* holding the clock low before request-to-send */
+#define TX_SENDING  2 /* keyboard is clocking the byte out of us */
+uint8_t txstate;
+uint8_t txbit;
+uint8_t txparity;
+
+/* timer0 ticks at 8 MHz/1024/(TICK_OCR+1), about 2 ms */
+#define TICK_OCR 15
+
+/* typematic repeat */
+#define REPEAT_DELAY_TICKS  244 /* 500 ms */
+#define REPEAT_RATE_TICKS   16  /* 30 keys/s, until the master sets it */
+uint8_t repeatrate;   // ticks between repeats, or 0 for none
+uint8_t arrowbatch;   // arrow keys queued by each repeat after the first
+uint8_t heldcode;   // scancode of the last key pressed and not released
+int8_t heldext;
+uint8_t heldchr;    // what to repeat, or 0 if it doesn't repeat
+uint8_t heldlost;   // a scancode was dropped since heldcode was pressed
+uint8_t repeatticks;
+uint8_t repeatbatch; // keys queued by the next repeat
 
 /* circular buffer for keys */
-#define MAX_BUF 32
+#define MAX_BUF 48
 volatile uint8_t bufsize;
 uint8_t charbuf[MAX_BUF];
 uint8_t bufhead;
 uint8_t buftail;
+uint8_t overflowed;
+uint8_t ticks;        // timer0 ticks, for timing keys
+uint8_t headstamp;    // tick the key at bufhead was queued
+uint8_t headstamped;  // zero if that isn't known
+
+/* SPI frame state: the byte to load after the current one goes out */
+#define SPI_COUNT   0
+#define SPI_STATUS  1
+#define SPI_AGE     2
+#define SPI_ERRORS  3
+#define SPI_KEYS    4
+uint8_t spinext;
+uint8_t spiremaining;
+uint8_t spierrindex;  // next error counter to send, or KB_NUM_ERRORS
+uint8_t spiage;
+uint8_t spilastcnt;
+uint8_t spiinframe;   // the count byte has gone out and the rest hasn't
+
+uint8_t spiquiet;
+
+/* ticks of SPI silence partway through a frame before resyncing; well
+ * over the master's gap between polls, which is a video frame */
+#define SPI_TIMEOUT_TICKS ((KB_RESYNC_MS*1000UL+2047)/2048)
 
 void sprinthex(char *str, uint8_t n)
 {
@@ -130,13 +157,160 @@ void kb_init()
   keyup = 0;
   extended = 0;
   mods = 0;
-  bitcount = 11;
-  scancode = 0;
+  ps2rx_reset(&ps2);
+  ps2quiet = 0;
+  memset(kberrors, 0, sizeof(kberrors));
+  errorschanged = 0;
   bufsize = bufhead = buftail = 0;
+  heldcode = heldchr = heldlost = 0;
+  repeatrate = REPEAT_RATE_TICKS;
+  arrowbatch = 1;
+  leds = LED_NUM;
+  txstate = TX_IDLE;
+  txleft = ackticks = 0;
+  cmdpending = CMD_TYPEMATIC | CMD_LEDS;
+}
+
+void buffer_put_key(uint8_t chr)
+{
+  if (bufsize < MAX_BUF)
+  {
+    if (bufsize == 0)
+    {
+      headstamp = ticks;
+      headstamped = 1;
+    }
+    charbuf[buftail] = chr;
+    if (++buftail >= MAX_BUF) buftail = 0;
+    bufsize++;
+  }
+  else
+    overflowed = 1;
+}
+
+void count_error(uint8_t err)
+{
+  if (kberrors[err] < 255)
+    kberrors[err]++;
+  errorschanged = 1;
+}
+
+/* a PS/2 frame was dropped. if it was the held key's break code, its
+ * release is gone, so stop repeating it, and forget a half-received
+ * prefix. if it was the F0 before the break code, the code that follows
+ * looks like a typematic make code; decode() ignores that once. */
+void scancode_lost(uint8_t err)
+{
+  count_error(err);
+  keyup = extended = 0;
+  heldchr = 0;
+  heldlost = 1;
+}
+
+/* release both lines */
+void ps2_release()
+{
+  DDRB &= ~(_BV(3) | _BV(4));
+  txstate = TX_IDLE;
+}
+
+/* start sending the next byte: hold the clock low for at least 100 us,
+ * then timer0's compare B takes it from there */
+void ps2_send_next()
+{
+  if (!txleft)
+  {
+    if (cmdpending & CMD_TYPEMATIC)
+    {
+      cmdpending &= ~CMD_TYPEMATIC;
+      txbytes[0] = 0xF3;
+      txbytes[1] = TYPEMATIC;
+    }
+    else
+    {
+      cmdpending &= ~CMD_LEDS;
+      txbytes[0] = 0xED;
+      txbytes[1] = leds;
+    }
+    txleft = 2;
+    txresends = 0;
+  }
+
+  DDRB |= _BV(4);
+  txstate = TX_INHIBIT;
+  ps2quiet = 0;
+  OCR0B = (TCNT0 + 2) % (TICK_OCR+1); // 1 or 2 timer counts, 128-256 us
+  TIFR = _BV(OCF0B);
+  TIMSK |= _BV(OCIE0B);
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+  // request-to-send: data low, release clock; the keyboard starts clocking
+  TIMSK &= ~_BV(OCIE0B);
+  DDRB |= _BV(3);
+  DDRB &= ~_BV(4);
+  txstate = TX_SENDING;
+  txbit = 0;
+  txparity = 1;
+}
+
+/* called on falling clock edges while sending; the keyboard samples each
+ * bit on the following rising edge */
+void ps2_send_bit()
+{
+  uint8_t b = txbytes[2-txleft];
+  if (txbit < 8) // data
+  {
+    if (b & _BV(txbit))
+    {
+      DDRB &= ~_BV(3);
+      txparity ^= 1;
+    }
+    else
+      DDRB |= _BV(3);
+  }
+  else if (txbit == 8) // odd parity
+  {
+    if (txparity)
+      DDRB &= ~_BV(3);
+    else
+      DDRB |= _BV(3);
+  }
+  else if (txbit == 9) // stop bit
+    DDRB &= ~_BV(3);
+  else // keyboard pulls data low to acknowledge the bits
+  {
+    ps2_release();
+    ps2rx_reset(&ps2);
+    ackticks = ACK_TIMEOUT_TICKS;
+  }
+  txbit++;
+}
+
+/* the keyboard's response to a command byte */
+void ps2_response(uint8_t code)
+{
+  ackticks = 0;
+  if (code == 0xFA)
+    txleft--;
+  else if (++txresends > MAX_RESENDS)
+    txleft = 0;
 }
 
 void decode(uint8_t code)
 {
+  if (ackticks && (code == 0xFA || code == 0xFE))
+  {
+    ps2_response(code);
+    return;
+  }
+  if (code == 0xAA) // self-test passed; the keyboard was reset
+  {
+    cmdpending = CMD_TYPEMATIC | CMD_LEDS;
+    return;
+  }
+
   if (code == 0xF0)
     keyup = 1;
   else if (code == 0xE0 || code == 0xE1)
@@ -151,6 +325,8 @@ void decode(uint8_t code)
         mods &= ~_BV(1);
       else if (code == 0x14) // left/right ctrl
         mods &= (extended) ? ~_BV(3) : ~_BV(2);
+      else if (code == heldcode && extended == heldext) // stop repeating
+        heldcode = heldchr = heldlost = 0;
     }
     else // handling a key press; store character
     {
@@ -160,27 +336,39 @@ void decode(uint8_t code)
         mods |= _BV(1);
       else if (code == 0x14) // left/right ctrl
         mods |= (extended) ? _BV(3) : _BV(2);
-      else if (code <= 0x83)
+      else if (code == heldcode && extended == heldext)
       {
-        uint8_t chr;
-        if (extended)
-          chr = pgm_read_byte(codetable_extended+code);
-        else if (mods & 0b1100) // ctrl
-          chr = pgm_read_byte(codetable+code) & 31;
-        else if (mods & 0b0011) // shift
-          chr = pgm_read_byte(codetable_shifted+code);
-        else
-          chr = pgm_read_byte(codetable+code);
-
+        // the keyboard's own typematic repeat; we make our own. after a
+        // dropped frame it may be a break code that lost its F0
+        if (heldlost)
+          heldcode = heldlost = 0;
+      }
+      else if (code <= KEY_MAX_CODE)
+      {
+        uint8_t chr = key_lookup(code, mods, extended);
         if (!chr) chr = '?';
 
-        // add to buffer
-        if (bufsize < MAX_BUF)
+        if (chr == K_CAPSLK)
+        {
+          leds ^= LED_CAPS;
+          cmdpending |= CMD_LEDS;
+        }
+        else
         {
-          charbuf[buftail] = chr;
-          if (++buftail >= MAX_BUF) buftail = 0;
-          bufsize++;
+          if ((leds & LED_CAPS) &&
+              ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z')))
+            chr ^= 0x20;
+          buffer_put_key(chr);
         }
+
+        // lock keys and the like don't repeat
+        heldcode = code;
+        heldext = extended;
+        heldlost = 0;
+        heldchr = (chr == K_CAPSLK || chr == K_NUMLK || chr == K_SCRLK ||
+                   chr == K_PRTSC || chr == K_BREAK) ? 0 : chr;
+        repeatticks = REPEAT_DELAY_TICKS;
+        repeatbatch = 1;
       }
     }
     extended = 0;
@@ -194,18 +382,27 @@ ISR(PCINT0_vect)
   if (PINB & _BV(4))
     return;
 
-  --bitcount;
-  if (bitcount >= 2 && bitcount <= 9)
+  ps2quiet = 0;
+  if (txstate == TX_SENDING)
   {
-    scancode >>= 1;
-    if (PINB & _BV(3))
-      scancode |= 0x80;
+    ps2_send_bit();
+    return;
   }
-  else if (bitcount == 0)
+  else if (txstate == TX_INHIBIT) // that was us
+    return;
+
+  switch (ps2rx_bit(&ps2, (PINB & _BV(3)) ? 1 : 0))
   {
-    decode(scancode);
-    scancode = 0;
-    bitcount = 11;
+    case PS2RX_DONE:
+      decode(ps2.scancode);
+      break;
+    case PS2RX_PARITY:
+      scancode_lost(KB_ERR_PARITY);
+      break;
+    case PS2RX_START:
+    case PS2RX_STOP:
+      scancode_lost(KB_ERR_FRAMING);
+      break;
   }
 }
 
@@ -217,39 +414,180 @@ uint8_t buffer_get_key()
   uint8_t newchar = charbuf[bufhead];
   if (++bufhead >= MAX_BUF) bufhead = 0;
   bufsize--;
+  if (bufsize)  // only the time of the first key into an empty buffer is kept
+    headstamped = 0;
 
   return newchar;
 }
 
+uint8_t spi_frame_start()
+{
+  uint8_t count = bufsize;
+  if (count > KB_FRAME_MAX)
+    count = KB_FRAME_MAX;
+  spiremaining = count;
+  spiage = KB_AGE_UNKNOWN;
+  if (count && headstamped)
+  {
+    spiage = ticks - headstamp;
+    if (spiage == KB_AGE_UNKNOWN)
+      spiage--;
+  }
+  spierrindex = KB_NUM_ERRORS;
+  if (errorschanged)
+  {
+    spierrindex = 0;
+    errorschanged = 0;
+    count |= KB_COUNT_ERRORS;
+  }
+  spinext = (count) ? SPI_STATUS : SPI_COUNT;
+  spiinframe = 0;
+  return count;
+}
+
+uint8_t spi_next_state()
+{
+  if (spierrindex < KB_NUM_ERRORS)
+    return SPI_ERRORS;
+  return (spiremaining) ? SPI_KEYS : SPI_COUNT;
+}
+
+uint8_t spi_status()
+{
+  uint8_t status = 0;
+  if (mods & 0b0011) status |= KB_STAT_SHIFT;
+  if (mods & 0b1100) status |= KB_STAT_CTRL;
+  if (overflowed)    status |= KB_STAT_OVERFLOW;
+  overflowed = 0;
+  return status;
+}
+
+/* the settings byte the master sent with a count byte (see keycodes.h) */
+void spi_settings(uint8_t set)
+{
+  if ((set & KB_SET_MARK_MASK) != KB_SET_MARK)
+    return;
+  repeatrate = (set & KB_SET_RATE)*KB_SET_RATE_TICKS;
+  arrowbatch = (set & KB_SET_BATCH) ? KB_FRAME_MAX : 1;
+}
+
 void spi_init()
 {
   DDRB |= _BV(1);
-  USICR = _BV(USIWM0) | _BV(USICS1);
+  PORTB |= _BV(0); // pull MOSI up, so an unconnected line reads FF
+  overflowed = 0;
+  USIDR = spi_frame_start();
+  USISR = _BV(USIOIF); // clear overflow flag and counter
+  USICR = _BV(USIOIE) | _BV(USIWM0) | _BV(USICS1);
+
+  // timer0 in CTC mode ticks for key repeat and to time out stalled frames
+  TCCR0A = _BV(WGM01);
+  OCR0A = TICK_OCR;
+  TCCR0B = _BV(CS02) | _BV(CS00);
+  TIMSK |= _BV(OCIE0A);
 }
 
-int main()
+ISR(USI_OVF_vect)
 {
-  spi_init();
-  kb_init();
+  // a byte has been shifted out; clear the flag, reset the counter,
+  // and preload the next byte of the frame. what the master sent with a
+  // count byte is left in USIDR until then
+  USISR = _BV(USIOIF);
+  spiquiet = 0;
+  if (!spiinframe)
+    spi_settings(USIDR);
+  switch (spinext)
+  {
+    case SPI_STATUS:
+      spiinframe = 1;
+      USIDR = spi_status();
+      spinext = SPI_AGE;
+      break;
+    case SPI_AGE:
+      USIDR = spiage;
+      spinext = spi_next_state();
+      break;
+    case SPI_ERRORS:
+      USIDR = kberrors[spierrindex++];
+      spinext = spi_next_state();
+      break;
+    case SPI_KEYS:
+      USIDR = buffer_get_key();
+      spiremaining--;
+      spinext = spi_next_state();
+      break;
+    default:
+      USIDR = spi_frame_start();
+      break;
+  }
+}
 
-  sei();
-  uint8_t dataval = 0;
-  while (1)
+ISR(TIMER0_COMPA_vect)
+{
+  ticks++;
+
+  if (heldchr && repeatrate && --repeatticks == 0)
   {
-    // wait for start condition
-    while (!(USISR & _BV(USISIF)));
+    uint8_t n = repeatbatch;
+    while (n--)
+      buffer_put_key(heldchr);
+    // the first repeat is a single key, so it comes as soon as it would
+    // have; batching starts after it
+    if (heldchr >= K_UP && heldchr <= K_RIGHT)
+      repeatbatch = arrowbatch;
+    repeatticks = repeatrate*repeatbatch;
+  }
 
-    // clear counter overflow flag
-    USISR = _BV(USIOIF);
+  if (txstate == TX_SENDING && ++ps2quiet >= PS2_TIMEOUT_TICKS)
+  {
+    // the keyboard stopped clocking our byte out
+    ps2_release();
+    count_error(KB_ERR_TIMEOUT);
+    txleft = 0;
+  }
+  else if (ps2rx_busy(&ps2) && ++ps2quiet >= PS2_TIMEOUT_TICKS)
+  {
+    ps2rx_reset(&ps2);
+    scancode_lost(KB_ERR_TIMEOUT);
+  }
 
-    // send data
-    USIDR = dataval;
+  // give up on a command the keyboard doesn't answer
+  if (ackticks && --ackticks == 0)
+    txleft = 0;
 
-    // wait for the transfer to finish
-    while (!(USISR & _BV(USIOIF)));
+  if (txstate == TX_IDLE && !ackticks && !ps2rx_busy(&ps2) &&
+      (txleft || cmdpending))
+    ps2_send_next();
 
-    // get byte from keyboard buffer
-    dataval = buffer_get_key();
+  // the master stopped partway through a frame, or a glitch left bits in
+  // the counter that haven't moved since the last tick; start over.
+  // any key already loaded into USIDR is lost, and the error counters are
+  // sent again in case they were cut off.
+  uint8_t cnt = USISR & 0x0F;
+  if (spiquiet < SPI_TIMEOUT_TICKS)
+    spiquiet++;
+  if ((spiinframe && spiquiet >= SPI_TIMEOUT_TICKS) ||
+      (cnt && cnt == spilastcnt))
+  {
+    errorschanged = 1;
+    USIDR = spi_frame_start();
+    USISR = _BV(USIOIF);
+    cnt = 0;
   }
+  spilastcnt = cnt;
+}
+
+int main()
+{
+  spi_init();
+  kb_init();
+
+  sei();
+
+  // everything happens in the PS/2 clock, USI and timer interrupts
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while (1)
+    sleep_mode();
+
   return 0;
 }
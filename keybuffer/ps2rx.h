@@ -0,0 +1,83 @@
+/* PS/2 frame receiver
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * A PS/2 frame is 11 bits, read on falling clock edges: a 0 start bit,
+ * 8 data bits (LSB first), an odd parity bit, and a 1 stop bit.
+ *
+ * This doesn't touch any hardware, so tools/ps2sim.c can feed it the
+ * same bits the pin change interrupt does.
+ */
+
+#ifndef _PS2RX_H_
+#define _PS2RX_H_
+
+#include <stdint.h>
+
+#define PS2_FRAME_BITS 11
+
+/* results of ps2rx_bit() */
+#define PS2RX_BUSY    0 /* frame in progress */
+#define PS2RX_DONE    1 /* frame complete; scancode is valid */
+#define PS2RX_START   2 /* start bit was 1; ignored, still waiting for one */
+#define PS2RX_PARITY  3 /* parity error; frame dropped */
+#define PS2RX_STOP    4 /* stop bit was 0; frame dropped */
+
+typedef struct
+{
+  uint8_t bitcount; /* bits left in the frame */
+  uint8_t scancode;
+  uint8_t ones;     /* 1 bits received, including parity */
+} ps2rx_t;
+
+/* Wait for the start of a new frame */
+static inline void ps2rx_reset(ps2rx_t *rx)
+{
+  rx->bitcount = PS2_FRAME_BITS;
+}
+
+/* Returns true if a frame is partly received */
+static inline uint8_t ps2rx_busy(const ps2rx_t *rx)
+{
+  return rx->bitcount != PS2_FRAME_BITS;
+}
+
+/* Handle one bit sampled on a falling clock edge */
+static inline uint8_t ps2rx_bit(ps2rx_t *rx, uint8_t bit)
+{
+  uint8_t n = --rx->bitcount;
+  if (n == PS2_FRAME_BITS-1) /* start bit */
+  {
+    if (bit)
+    {
+      ps2rx_reset(rx);
+      return PS2RX_START;
+    }
+    rx->scancode = 0;
+    rx->ones = 0;
+  }
+  else if (n >= 2) /* data bits */
+  {
+    rx->scancode >>= 1;
+    if (bit)
+    {
+      rx->scancode |= 0x80;
+      rx->ones++;
+    }
+  }
+  else if (n == 1) /* parity bit */
+    rx->ones += bit;
+  else /* stop bit */
+  {
+    ps2rx_reset(rx);
+    if (!bit)
+      return PS2RX_STOP;
+    if (!(rx->ones & 1))
+      return PS2RX_PARITY;
+    return PS2RX_DONE;
+  }
+  return PS2RX_BUSY;
+}
+
+#endif
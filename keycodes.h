@@ -38,4 +38,38 @@
 #define K_PRTSC   0x99
 #define K_BREAK   0x9A
 
+/* SPI framing. Each poll reads a count byte: the number of keycodes in the
+ * frame (0 to KB_FRAME_MAX), plus KB_COUNT_ERRORS if the PS/2 error
+ * counters have changed. If it is nonzero, a status byte and an age byte
+ * follow, then the KB_NUM_ERRORS error counters if flagged, then the
+ * keycodes. The age byte is how many 2.048 ms ticks the first key spent in
+ * the buffer, or KB_AGE_UNKNOWN. The master may take several polls over a
+ * frame, a video frame or so apart; after KB_RESYNC_MS of silence partway
+ * through one, the buffer starts over with a new count byte. */
+#define KB_FRAME_MAX      4
+#define KB_RESYNC_MS      100
+#define KB_COUNT_ERRORS   0x40
+#define KB_AGE_UNKNOWN    0xFF
+#define KB_STAT_SHIFT     0x01  /* either shift key held */
+#define KB_STAT_CTRL      0x02  /* either ctrl key held */
+#define KB_STAT_OVERFLOW  0x80  /* keys were dropped since the last frame */
+
+/* Key repeat settings. The master clocks out a settings byte while it reads
+ * each count byte: KB_SET_MARK, the repeat interval in units of
+ * KB_SET_RATE_TICKS (0 for no repeat), and KB_SET_BATCH to repeat held
+ * arrow keys KB_FRAME_MAX at a time. A byte without the mark, such as the
+ * 0 sent with the rest of a frame or the FF of an unconnected MOSI line, is
+ * ignored and the buffer keeps its own defaults. */
+#define KB_SET_MARK       0x40
+#define KB_SET_MARK_MASK  0xC0
+#define KB_SET_BATCH      0x20
+#define KB_SET_RATE       0x0F
+#define KB_SET_RATE_TICKS 4
+
+/* PS/2 error counters, in the order they are sent. Each stops at 255. */
+#define KB_ERR_PARITY     0
+#define KB_ERR_FRAMING    1     /* bad start or stop bit */
+#define KB_ERR_TIMEOUT    2     /* clock stopped partway through a frame */
+#define KB_NUM_ERRORS     3
+
 #endif
@@ -0,0 +1,172 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * latency.c - keyboard-to-screen latency statistics
+ */
+
+#include "latency.h"
+
+#ifdef LATENCY_STATS
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "video.h"
+#include "keycodes.h"
+#include "report.h"
+
+extern uint16_t frame;
+
+/* the keyboard buffer's 2.048 ms tick, in timer1 ticks */
+#define KB_TICK       ((uint16_t)(2048UL*(F_CPU/1000000)/FRAME_PRESCALE))
+
+/* a probe that hasn't finished after this long is abandoned (1 s) */
+#define PROBE_TIMEOUT ((uint16_t)(F_CPU/FRAME_PRESCALE))
+
+/* stages */
+#define LAT_KBD     0 /* waiting in the keyboard buffer */
+#define LAT_LOCAL   1 /* poll to the first byte going out of the UART */
+#define LAT_ECHO    2 /* to the echo arriving from the host */
+#define LAT_SCREEN  3 /* waiting in the receive buffer to be drawn */
+#define LAT_TOTAL   4
+
+static const char stagenames[LATENCY_STAGES][7] PROGMEM = {
+  "kbd   ", "local ", "echo  ", "screen", "total "
+};
+
+/* probe states */
+#define PROBE_IDLE    0
+#define PROBE_POLLED  1 /* waiting for the first byte the key sends */
+#define PROBE_SENT    2 /* waiting for it to come back */
+#define PROBE_ECHOED  3 /* waiting for it to be drawn */
+
+static volatile uint8_t probestate;
+static uint8_t probechar;
+static uint16_t t_key, t_poll, t_tx;
+static volatile uint16_t t_rx;
+
+/* bucket n counts times under 16<<n timer1 ticks; the last one is
+ * everything longer */
+static uint8_t hist[LATENCY_STAGES][LATENCY_BUCKETS];
+
+/* timer1 ticks, counted from the frame counter */
+static uint16_t lat_now()
+{
+  uint16_t t;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    t = frame*(FRAME_TOP+1) + TCNT1;
+  }
+  return t;
+}
+
+static void lat_record(uint8_t stage, uint16_t ticks)
+{
+  uint8_t b = 0;
+  /* the frame counter is bumped a little before timer1 wraps, so a stamp
+   * taken in the receive interrupt then can be up to a frame early */
+  if (ticks & 0x8000)
+    ticks = 0;
+  ticks >>= 4;
+  while (ticks && b < LATENCY_BUCKETS-1)
+  {
+    ticks >>= 1;
+    b++;
+  }
+  if (hist[stage][b] < 255)
+    hist[stage][b]++;
+}
+
+void lat_keys_polled(uint8_t age)
+{
+  uint16_t now = lat_now();
+  if (age == KB_AGE_UNKNOWN)
+    return;
+  if (probestate != PROBE_IDLE && now-t_poll < PROBE_TIMEOUT)
+    return;
+  t_poll = now;
+  t_key = now - age*KB_TICK;
+  probestate = PROBE_POLLED;
+}
+
+void lat_keys_done()
+{
+  if (probestate == PROBE_POLLED) /* the keys didn't send anything */
+    probestate = PROBE_IDLE;
+}
+
+void lat_tx(uint8_t c)
+{
+  if (probestate == PROBE_POLLED)
+  {
+    probechar = c;
+    t_tx = lat_now();
+    probestate = PROBE_SENT;
+  }
+}
+
+void lat_rx(uint8_t c)
+{
+  if (probestate == PROBE_SENT && c == probechar)
+  {
+    t_rx = lat_now();
+    probestate = PROBE_ECHOED;
+  }
+}
+
+void lat_print(uint8_t c)
+{
+  uint8_t state = probestate;
+  if ((state == PROBE_SENT || state == PROBE_ECHOED) && c == probechar)
+  {
+    uint16_t now = lat_now();
+    if (state == PROBE_SENT) /* local echo */
+      t_rx = t_tx;
+    lat_record(LAT_KBD, t_poll-t_key);
+    lat_record(LAT_LOCAL, t_tx-t_poll);
+    lat_record(LAT_ECHO, t_rx-t_tx);
+    lat_record(LAT_SCREEN, now-t_rx);
+    lat_record(LAT_TOTAL, now-t_key);
+    probestate = PROBE_IDLE;
+  }
+}
+
+/* print n right-aligned in a 4-character column */
+static void lat_putnum(uint16_t n)
+{
+  char str[6];
+  uint8_t len = report_dec(str, n) - str;
+  str[len] = '\0';
+  while (len++ < 4)
+    video_putc(' ');
+  video_puts(str);
+}
+
+void lat_report()
+{
+  uint8_t s, b;
+  video_puts_P(PSTR("ms<   "));
+  for (b = 0; b < LATENCY_BUCKETS-1; b++) /* bucket bounds, rounded up */
+    lat_putnum(((16000UL*FRAME_PRESCALE << b) + F_CPU-1) / F_CPU);
+  video_puts_P(PSTR("more"));
+  video_lfwd();
+  for (s = 0; s < LATENCY_STAGES; s++)
+  {
+    video_puts_P(stagenames[s]);
+    for (b = 0; b < LATENCY_BUCKETS; b++)
+      lat_putnum(hist[s][b]);
+    video_lfwd();
+  }
+}
+
+void lat_reset()
+{
+  memset(hist, 0, sizeof(hist));
+  probestate = PROBE_IDLE;
+}
+
+#endif
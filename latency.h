@@ -0,0 +1,54 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * latency.h - keyboard-to-screen latency statistics
+ *
+ * One keypress at a time is followed from the keyboard buffer to the
+ * glyph its echo puts on the screen. Times are timer1 ticks counted from
+ * the frame counter, so they line up with frames. Built in only when
+ * LATENCY_STATS is defined (the Makefile's LATENCY option); otherwise
+ * these calls compile to nothing.
+ */
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+
+#ifdef LATENCY_STATS
+
+/* A frame with keys was read from the keyboard buffer. age is how long
+ * the first key waited there, in the buffer's ticks, or KB_AGE_UNKNOWN. */
+void lat_keys_polled(uint8_t age);
+
+/* The keys from the last poll have been handled */
+void lat_keys_done();
+
+/* A character is being sent to the host */
+void lat_tx(uint8_t c);
+
+/* A character arrived from the host (in the receive interrupt) */
+void lat_rx(uint8_t c);
+
+/* A received character is being drawn */
+void lat_print(uint8_t c);
+
+/* Print the histogram at the cursor */
+void lat_report();
+
+/* Clear the histogram */
+void lat_reset();
+
+#else
+#define lat_keys_polled(age)
+#define lat_keys_done()
+#define lat_tx(c)
+#define lat_rx(c)
+#define lat_print(c)
+#define lat_report()
+#define lat_reset()
+#endif
+
+#endif
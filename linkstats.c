@@ -0,0 +1,95 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * linkstats.c - serial line statistics
+ */
+
+#include "linkstats.h"
+
+#ifdef LINK_STATS
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "report.h"
+
+/* in the order they're reported */
+#define LINK_OVERRUNS   0
+#define LINK_FRAMING    1
+#define LINK_PARITY     2
+#define LINK_DROPPED    3
+#define LINK_TOOLONG    4
+#define LINK_CANCELLED  5
+#define LINK_COUNTS     6
+
+static volatile uint32_t received;
+static volatile uint16_t counts[LINK_COUNTS];
+
+static void link_count(uint8_t n)
+{
+  if (counts[n] != 0xFFFF)
+    counts[n]++;
+}
+
+void link_rx(uint8_t status)
+{
+  received++;
+  if (status & _BV(DOR0))
+    link_count(LINK_OVERRUNS);
+  if (status & _BV(FE0))
+    link_count(LINK_FRAMING);
+  if (status & _BV(UPE0))
+    link_count(LINK_PARITY);
+}
+
+void link_dropped()
+{
+  link_count(LINK_DROPPED);
+}
+
+void link_esc_too_long()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    link_count(LINK_TOOLONG);
+  }
+}
+
+void link_esc_cancelled()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    link_count(LINK_CANCELLED);
+  }
+}
+
+void link_report()
+{
+  uint32_t r;
+  uint16_t c[LINK_COUNTS];
+  uint8_t i;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    r = received;
+    memcpy(c, (const void *)counts, sizeof(c));
+  }
+  reply_start(95);
+  reply_num(r);
+  for (i = 0; i < LINK_COUNTS; i++)
+    reply_num(c[i]);
+  reply_end();
+}
+
+void link_reset()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    received = 0;
+    memset((void *)counts, 0, sizeof(counts));
+  }
+}
+
+#endif
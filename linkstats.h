@@ -0,0 +1,54 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * linkstats.h - serial line statistics
+ *
+ * Counts what happens to the bytes coming from the host, and sends the
+ * counts in answer to "ESC [ ? 95 n":
+ *   ESC [ ? 95 ; received ; overruns ; framing errors ; parity errors ;
+ *     dropped ; too long ; cancelled n
+ * Overruns are bytes the UART lost because the last one hadn't been read
+ * yet; dropped bytes were read but the receive buffer was full. Too long
+ * and cancelled count escape sequences abandoned because they didn't fit
+ * in the parameter buffer, or because of a CAN or SUB. The received count
+ * is 32 bits; the others stop at 65535. "ESC [ ? 96 n" clears them. Built
+ * in only when LINK_STATS is defined (the Makefile's LINKSTATS option);
+ * otherwise these calls compile to nothing.
+ */
+
+#ifndef _LINKSTATS_H_
+#define _LINKSTATS_H_
+
+#include <stdint.h>
+
+#ifdef LINK_STATS
+
+/* A byte was read from the UART; status is UCSR0A from before reading it
+ * (called in the receive interrupt) */
+void link_rx(uint8_t status);
+
+/* The receive buffer was full (called with interrupts off) */
+void link_dropped();
+
+/* An escape sequence was abandoned */
+void link_esc_too_long();
+void link_esc_cancelled();
+
+/* Send the report to the host */
+void link_report();
+
+/* Clear the counts */
+void link_reset();
+
+#else
+#define link_rx(status)
+#define link_dropped()
+#define link_esc_too_long()
+#define link_esc_cancelled()
+#define link_report()
+#define link_reset()
+#endif
+
+#endif
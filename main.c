@@ -8,11 +8,14 @@
 
 #include <avr/sfr_defs.h>
 #include <avr/io.h>
-#include <util/delay.h>
+#include <avr/interrupt.h>
 #include <stdlib.h>
 
 #include "defs.h"
 #include "video.h"
+#include "keycodes.h"
+#include "latency.h"
+#include "frameprof.h"
 
 /* SPI port definitions for keyboard buffer */
 #define DDR_SPI PORTB
@@ -33,43 +36,155 @@ void puthex(uint8_t n)
 }
 
 extern void app_setup();
-extern void app_handle_key(uint8_t key);
+extern void app_handle_keys(uint8_t key, uint8_t count);
 extern uint8_t app_main_loop();
 uint16_t frame;
+uint8_t kbstatus;
+uint8_t kbage;
+uint8_t kberrors[KB_NUM_ERRORS];
+uint8_t kbsettings;   /* sent with each count byte; see keycodes.h */
 
 void spi_init()
 {
   PORTB = 0;
   DDRB |= _BV(DD_MOSI) | _BV(DD_SCK) | _BV(DD_SS);
   SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPR0);
-  volatile char dummy;
-  dummy = SPSR;
-  dummy = SPDR;
+  (void)SPSR;
+  (void)SPDR;
 }
 
-uint8_t spi_write_read(uint8_t dataout)
+/* The keyboard frame (see keycodes.h) is read in the background, a byte
+ * per timer 0 interrupt, KB_BYTE_CYCLES apart so the buffer has
+ * KB_BYTE_GAP_US to load each byte after the last, and at most
+ * KB_PASS_BYTES per pass so the interrupts stay out of the video (see
+ * defs.h). kblen is the length of the frame, once its count byte is in,
+ * and kbpos the bytes read so far; kblen is 0 when no frame is being read
+ * or waiting to be taken. */
+static volatile uint8_t kbframe[KB_FRAME_BYTES];
+static volatile uint8_t kbpos;
+static volatile uint8_t kblen;
+static volatile uint8_t kbpass;   /* bytes left to read in this pass */
+static volatile uint8_t kbresync; /* passes to leave the buffer alone */
+
+/* the keys of the last frame taken, for poll_keyboard() */
+static uint8_t kbkeys[KB_FRAME_MAX];
+static uint8_t kbnumkeys;
+
+void kb_timer_init()
 {
-  uint8_t datain;
-  SPDR = dataout;
-  while (!(SPSR & _BV(SPIF)));
-  datain = SPSR; /* clear SPIF flag */
-  datain = SPDR;
-  return datain;
+  TCCR0A = _BV(WGM01);          /* CTC */
+  TCCR0B = _BV(CS01);           /* F_CPU/8 */
+  OCR0A = KB_BYTE_CYCLES/8-1;
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+  uint8_t b;
+  (void)SPSR;                   /* reading SPSR then SPDR clears SPIF */
+  b = SPDR;
+  kbframe[kbpos++] = b;
+  if (kbpos == 1)
+  {
+    /* if there are keys or new error counts, the rest of the frame follows.
+     * a count that's out of range means we're out of step with the
+     * buffer, which starts over once it has been left alone a while */
+    uint8_t count = b & ~KB_COUNT_ERRORS;
+    if (b && count <= KB_FRAME_MAX)
+      kblen = 3+count+((b & KB_COUNT_ERRORS) ? KB_NUM_ERRORS : 0);
+    else if (b)
+    {
+      kbframe[0] = 0;
+      kbresync = KB_RESYNC_PASSES;
+    }
+  }
+  if (kbpos < kblen && --kbpass)
+    SPDR = 0;
+  else
+    TIMSK0 = 0;
+}
+
+/* Takes the keyboard frame read so far, if it's complete and the keys of
+ * the last one have been handled */
+static void kb_take_frame()
+{
+  uint8_t i, j;
+  if (!kblen || kbpos < kblen || kbnumkeys)
+    return;
+  if (kbframe[0])
+  {
+    kbnumkeys = kbframe[0] & ~KB_COUNT_ERRORS;
+    kbstatus = kbframe[1];
+    kbage = kbframe[2];
+    j = 3;
+    if (kbframe[0] & KB_COUNT_ERRORS)
+      for (i = 0; i < KB_NUM_ERRORS; i++)
+        kberrors[i] = kbframe[j++];
+    for (i = 0; i < kbnumkeys; i++)
+      kbkeys[i] = kbframe[j++];
+  }
+  kblen = 0;
+}
+
+/* Takes the last keyboard frame if the main loop finished before it did,
+ * then starts or resumes reading, right after the video so the pass has
+ * all the time until the next frame. The buffer keeps the count byte
+ * loaded between frames, so it's read straight away. */
+void kb_start_read()
+{
+  kb_take_frame();
+  if (kbresync)
+  {
+    kbresync--;
+    return;
+  }
+  if (!kblen)
+  {
+    kbpos = 0;
+    kblen = 1;
+  }
+  kbpass = (KB_PASS_BYTES < KB_FRAME_BYTES) ? KB_PASS_BYTES : KB_FRAME_BYTES;
+  SPDR = (kbpos) ? 0 : kbsettings;
+  TCNT0 = 0;
+  TIFR0 = _BV(OCF0A);
+  TIMSK0 = _BV(OCIE0A);
+}
+
+/* Hands the keys taken to the app */
+static void kb_handle_keys()
+{
+  uint8_t i;
+  if (kbnumkeys)
+    lat_keys_polled(kbage);
+
+  /* runs of the same key, as from key repeat, go to the app together */
+  for (i = 0; i < kbnumkeys; )
+  {
+    uint8_t key = kbkeys[i];
+    uint8_t run = 1;
+    while (++i < kbnumkeys && kbkeys[i] == key)
+      run++;
+    if (key)
+      app_handle_keys(key, run);
+  }
+  kbnumkeys = 0;
 }
 
+/* Handles the keys taken when the read started, then those of the frame
+ * it read, if it has finished */
 void poll_keyboard()
 {
-  /* pull keystrokes out of the buffer until it's empty
-   * and send them to the app */
-  uint8_t key;
-  while ((key = spi_write_read(0)))
-    app_handle_key(key);
+  kb_handle_keys();
+  kb_take_frame();
+  kb_handle_keys();
+  lat_keys_done();
 }
 
 int main()
 {
   video_setup();
   spi_init();
+  kb_timer_init();
+  fp_init();
 
   app_setup();
 
@@ -79,10 +194,15 @@ int main()
   for (;;)
   {
     video_wait();
+    fp_mark(FP_WAIT);
     video_output_frame();
+    fp_mark(FP_DRAW);
+    kb_start_read();
   
     app_main_loop();
+    fp_mark(FP_LOOP);
     poll_keyboard();
+    fp_mark(FP_KEYBOARD);
 
     frame++;
   }
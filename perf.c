@@ -0,0 +1,123 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * perf.c - performance overlay
+ */
+
+#include "perf.h"
+
+#ifdef PERF_STATS
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "video.h"
+#include "report.h"
+
+/* frames in about a second; the rate shown is bytes per this many frames */
+#define PERF_FRAMES ((F_CPU/FRAME_PRESCALE + (FRAME_TOP+1)/2)/(FRAME_TOP+1))
+
+static uint8_t shown;
+static uint8_t frames;
+static uint16_t rxrate;
+static uint16_t late;
+
+/* updated in the receive interrupt */
+static volatile uint16_t rxcount;
+static volatile uint16_t dropped;
+static volatile uint8_t highwater;
+
+void perf_enqueued(uint8_t size)
+{
+  rxcount++;
+  if (size > highwater)
+    highwater = size;
+}
+
+void perf_dropped()
+{
+  rxcount++;
+  if (dropped != 0xFFFF)
+    dropped++;
+}
+
+void perf_late()
+{
+  if (late != 0xFFFF)
+    late++;
+}
+
+/* append a label and n to the line at p */
+static char *perf_field(char *p, const char *label, uint16_t n)
+{
+  while (*label)
+    *p++ = *label++;
+  return report_dec(p, n);
+}
+
+static void perf_draw()
+{
+  char line[52]; /* the longest it can be */
+  char *p = line;
+  uint16_t d;
+  uint8_t h;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    d = dropped;
+    h = highwater;
+  }
+  p = perf_field(p, "rx ", rxrate);
+  p = perf_field(p, "B/s  buf ", h);
+  p = perf_field(p, "/", RX_BUF_SIZE);
+  p = perf_field(p, "  dropped ", d);
+  p = perf_field(p, "  late ", late);
+  *p = '\0';
+  video_putline(TILES_HIGH-1, line);
+  video_invert_range(0, TILES_HIGH-1, TILES_WIDE);
+}
+
+void perf_frame()
+{
+  if (!shown || ++frames < PERF_FRAMES)
+    return;
+  frames = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    rxrate = rxcount;
+    rxcount = 0;
+  }
+  perf_draw();
+}
+
+void perf_redraw()
+{
+  if (shown)
+    perf_draw();
+}
+
+void perf_show(uint8_t on)
+{
+  if (on == shown)
+    return;
+  shown = on;
+  video_set_status_row(on);
+  if (on)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      rxcount = dropped = highwater = 0;
+    }
+    rxrate = late = frames = 0;
+    perf_draw();
+  }
+}
+
+void perf_toggle()
+{
+  perf_show(!shown);
+}
+
+#endif
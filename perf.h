@@ -0,0 +1,56 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * perf.h - performance overlay
+ *
+ * A status line at the bottom of the screen, shown with Scroll Lock or
+ * "ESC [ ? 92 h" and hidden with Scroll Lock or "ESC [ ? 92 l", with the
+ * bytes received in the last second, the receive buffer's high-water
+ * mark, bytes dropped because the buffer was full and frames that started
+ * late because the main loop overran. The counts start over when it's
+ * shown. Built in only when PERF_STATS is defined (the Makefile's PERF
+ * option); otherwise these calls compile to nothing.
+ */
+
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <stdint.h>
+
+#ifdef PERF_STATS
+
+/* A byte went into the receive buffer, which now holds size bytes
+ * (called with interrupts off) */
+void perf_enqueued(uint8_t size);
+
+/* A byte was dropped because the receive buffer was full (called with
+ * interrupts off) */
+void perf_dropped();
+
+/* The frame timer had already fired when the main loop started waiting */
+void perf_late();
+
+/* Call once per frame while the terminal has the screen */
+void perf_frame();
+
+/* Draw the overlay again, if it's shown, after something else has
+ * written over it */
+void perf_redraw();
+
+/* Show or hide the overlay */
+void perf_show(uint8_t on);
+void perf_toggle();
+
+#else
+#define perf_enqueued(size)
+#define perf_dropped()
+#define perf_late()
+#define perf_frame()
+#define perf_redraw()
+#define perf_show(on)
+#define perf_toggle()
+#endif
+
+#endif
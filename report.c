@@ -0,0 +1,55 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * report.c - number formatting and replies for the optional statistics
+ */
+
+#include "report.h"
+#include "defs.h"
+
+#if defined(LATENCY_STATS) || defined(PERF_STATS) || defined(REPLY_QUEUE)
+
+char *report_dec(char *p, uint32_t n)
+{
+  char digits[10];
+  uint8_t i = 0;
+  do
+  {
+    digits[i++] = '0' + n%10;
+    n /= 10;
+  } while (n);
+  while (i)
+    *p++ = digits[--i];
+  return p;
+}
+
+#endif
+
+#ifdef REPLY_QUEUE
+
+static void reply_digits(uint32_t n)
+{
+  char digits[10];
+  char *end = report_dec(digits, n);
+  char *p;
+  for (p = digits; p < end; p++)
+    uart_reply(*p);
+}
+
+void reply_start(uint8_t code)
+{
+  uart_reply('\x1B');
+  uart_reply('[');
+  uart_reply('?');
+  reply_digits(code);
+}
+
+void reply_num(uint32_t n)
+{
+  uart_reply(';');
+  reply_digits(n);
+}
+
+#endif
@@ -0,0 +1,33 @@
+/* Terminalscope for AVR
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * report.h - number formatting and replies for the optional statistics
+ *
+ * The latency statistics and the performance overlay print numbers on the
+ * screen; the frame profiler and the serial line statistics send them to
+ * the host as a private report, "ESC [ ? code ; n ; n ... n".
+ */
+
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+#include <stdint.h>
+
+/* Writes n in decimal at p, without a terminator; returns the end */
+char *report_dec(char *p, uint32_t n);
+
+/* Queues a byte for the host; replies aren't echoed (terminal.c) */
+void uart_reply(char c);
+
+/* Starts a report: ESC [ ? and its code */
+void reply_start(uint8_t code);
+
+/* Sends a parameter of the report: ';' and n in decimal */
+void reply_num(uint32_t n);
+
+/* Ends the report */
+#define reply_end() uart_reply('n')
+
+#endif
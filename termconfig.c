@@ -9,20 +9,35 @@
 #include "termconfig.h"
 #include "video.h"
 #include "keycodes.h"
+#include "perf.h"
 
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
 #include <avr/eeprom.h>
+#include <util/crc16.h>
 
 #define PARAM_NAME_LEN  16
 #define PARAM_MAX_VALS  5
 #define PARAM_VAL_LEN   5
 
-#define EEPROM_MAGIC        0x42
-#define EEPROM_MAGIC_ADDR   0x00
-#define EEPROM_PROF1_ADDR   0x01
-#define EEPROM_PROF2_ADDR   (EEPROM_PROF1_ADDR+TC_NUM_PARAMS)
+/* Profiles are stored with each parameter's value index packed into as
+ * few bits as its number of values needs, in parameter order from the
+ * least significant bit of the first byte, and each profile straight after
+ * the one before. The parameters take PROFILE_BITS. */
+#define PROFILE_BITS    18
+#define PROFILES_BYTES  ((TC_NUM_PROFILES*PROFILE_BITS+7)/8)
+
+/* The configuration is saved as a log of records filling the EEPROM, each
+ * save going to the slot after the newest record, so no cell is rewritten
+ * more than once every EE_NUM_SLOTS saves. A record is a 16-bit sequence
+ * number, the packed profiles, and a CRC-8 of those seeded with
+ * EEPROM_MAGIC, so records in an older layout don't check out. The newest
+ * valid record is loaded. The CRC is written last; a save cut short by a
+ * power loss leaves the previous record in place. */
+#define EEPROM_MAGIC        0x49 /* change when the layout changes */
+#define EE_RECORD_SIZE      (2+PROFILES_BYTES+1)
+#define EE_NUM_SLOTS        ((E2END+1)/EE_RECORD_SIZE)
 
 typedef struct
 {
@@ -97,7 +112,40 @@ const termparam_t p_revvideo PROGMEM = {
   0
 };
 
-static const termparam_t *params[] = {
+const termparam_t p_smoothscroll PROGMEM = {
+  "Smooth scroll",
+  { "Off", "On", },
+  { 0, 1 },
+  2,
+  0
+};
+
+const termparam_t p_cursorblink PROGMEM = {
+  "Blinking cursor",
+  { "Off", "On", },
+  { 0, 1 },
+  2,
+  1
+};
+
+/* sent to the keyboard buffer; see KB_SET_* in keycodes.h */
+const termparam_t p_keyrepeat PROGMEM = {
+  "Key repeat",
+  { "Off", "10/s", "15/s", "20/s", "30/s" },
+  { 0, 12, 8, 6, 4 },
+  5,
+  4
+};
+
+const termparam_t p_arrowbatch PROGMEM = {
+  "Arrow batch",
+  { "1", "4" },
+  { 0, KB_SET_BATCH },
+  2,
+  0
+};
+
+static const termparam_t *params[TC_NUM_PARAMS] = {
   &p_baudrate,
   &p_databits,
   &p_parity,
@@ -105,37 +153,100 @@ static const termparam_t *params[] = {
   &p_enterchar,
   &p_localecho,
   &p_escseqs,
-  &p_revvideo
+  &p_revvideo,
+  &p_smoothscroll,
+  &p_cursorblink,
+  &p_keyrepeat,
+  &p_arrowbatch
 };
 
-static uint8_t profile1[TC_NUM_PARAMS];
-static uint8_t profile2[TC_NUM_PARAMS];
-static uint8_t profile1temp[TC_NUM_PARAMS];
-static uint8_t profile2temp[TC_NUM_PARAMS];
-static uint8_t *config;
+static uint8_t profiles[PROFILES_BYTES];
+static uint8_t profilestemp[PROFILES_BYTES];
+static uint8_t active[TC_NUM_PARAMS];     /* the current profile, unpacked */
+static uint8_t setupvals[TC_NUM_PARAMS];  /* the profile being edited */
 static uint8_t profilenumber;
+static uint8_t eeslot;  /* slot of the newest record, or EE_NUM_SLOTS */
+static uint16_t eeseq;  /* its sequence number */
+
+/* record being saved, and how much of it has been written */
+static uint8_t eebuf[EE_RECORD_SIZE];
+static uint8_t eepos = EE_RECORD_SIZE;
+static void (*eedone)();
 
 PGM_P cfg_param_name(uint8_t param)
 {
   return (PGM_P) &(params[param]->name);
 }
 
+/* the settings in use come from the active profile, even while another
+ * is being edited on the setup screen */
 uint8_t cfg_param_value(uint8_t param)
 {
-  uint8_t val = config[param];
+  uint8_t val = active[param];
   return pgm_read_byte(&(params[param]->vals[val]));
 }
 
+static PGM_P param_value_str(const uint8_t *vals, uint8_t param)
+{
+  return (PGM_P) &(params[param]->valnames[vals[param]]);
+}
+
 PGM_P cfg_param_value_str(uint8_t param)
 {
-  uint8_t val = config[param];
-  return (PGM_P) &(params[param]->valnames[val]);
+  return param_value_str(active, param);
+}
+
+/* Number of bits a parameter's value index is packed into */
+static uint8_t param_bits(uint8_t param)
+{
+  uint8_t n = pgm_read_byte(&(params[param]->numvals))-1;
+  uint8_t bits = 0;
+  while (n)
+  {
+    bits++;
+    n >>= 1;
+  }
+  return bits;
+}
+
+static void profile_pack(uint8_t *packed, uint8_t pn, const uint8_t *vals)
+{
+  uint8_t param, b, pos = pn*PROFILE_BITS;
+  for (param = 0; param < TC_NUM_PARAMS; param++)
+  {
+    uint8_t bits = param_bits(param);
+    for (b = 0; b < bits; b++, pos++)
+    {
+      if (vals[param] & _BV(b))
+        packed[pos>>3] |= _BV(pos&7);
+      else
+        packed[pos>>3] &= ~_BV(pos&7);
+    }
+  }
+}
+
+static void profile_unpack(uint8_t *vals, const uint8_t *packed, uint8_t pn)
+{
+  uint8_t param, b, pos = pn*PROFILE_BITS;
+  for (param = 0; param < TC_NUM_PARAMS; param++)
+  {
+    uint8_t bits = param_bits(param);
+    uint8_t val = 0;
+    for (b = 0; b < bits; b++, pos++)
+      if (packed[pos>>3] & _BV(pos&7))
+        val |= _BV(b);
+
+    /* if the value is corrupt, restore the default */
+    if (val >= pgm_read_byte(&(params[param]->numvals)))
+      val = pgm_read_byte(&(params[param]->defaultval));
+    vals[param] = val;
+  }
 }
 
 void cfg_set_profile(uint8_t pn)
 {
   profilenumber = pn;
-  config = (profilenumber) ? profile2 : profile1;
+  profile_unpack(active, profiles, pn);
 }
 
 uint8_t cfg_profile()
@@ -147,51 +258,104 @@ void cfg_set_defaults()
 {
   uint8_t i;
   for (i = 0; i < TC_NUM_PARAMS; i++)
-    profile1[i] = profile2[i] = pgm_read_byte(&(params[i]->defaultval));
+    active[i] = pgm_read_byte(&(params[i]->defaultval));
+  for (i = 0; i < TC_NUM_PROFILES; i++)
+    profile_pack(profiles, i, active);
+}
+
+static uint8_t *ee_record_addr(uint8_t slot)
+{
+  return (uint8_t *)(size_t)(slot*EE_RECORD_SIZE);
+}
+
+static uint8_t ee_crc_block(uint8_t crc, const uint8_t *data, uint8_t len)
+{
+  while (len--)
+    crc = _crc8_ccitt_update(crc, *data++);
+  return crc;
+}
+
+/* Returns true if the record in a slot checks out */
+static uint8_t ee_record_valid(uint8_t slot)
+{
+  const uint8_t *addr = ee_record_addr(slot);
+  uint8_t crc = EEPROM_MAGIC;
+  uint8_t i;
+  for (i = 0; i < EE_RECORD_SIZE-1; i++)
+    crc = _crc8_ccitt_update(crc, eeprom_read_byte(addr+i));
+  return crc == eeprom_read_byte(addr+EE_RECORD_SIZE-1);
 }
 
 void cfg_load()
 {
+  uint8_t slot;
   eeprom_busy_wait();
 
-  /* check for magic number */
-  uint8_t magic = eeprom_read_byte((const uint8_t *)EEPROM_MAGIC_ADDR);
-  if (magic != EEPROM_MAGIC)
+  /* find the newest valid record. sequence numbers are compared by their
+   * difference, so they can wrap around */
+  eeslot = EE_NUM_SLOTS;
+  eeseq = 0;
+  for (slot = 0; slot < EE_NUM_SLOTS; slot++)
+  {
+    if (!ee_record_valid(slot))
+      continue;
+    uint16_t seq = eeprom_read_word((const uint16_t *)ee_record_addr(slot));
+    if (eeslot == EE_NUM_SLOTS || (int16_t)(seq-eeseq) > 0)
+    {
+      eeslot = slot;
+      eeseq = seq;
+    }
+  }
+
+  if (eeslot == EE_NUM_SLOTS)
   {
     /* no data previously stored; set defaults and save */
     cfg_set_defaults();
-    cfg_save();
+    cfg_save(NULL);
   }
   else
   {
-    /* data previously stored; read it */
-    eeprom_busy_wait();
-    eeprom_read_block(profile1,(const void *)EEPROM_PROF1_ADDR,TC_NUM_PARAMS);
-    eeprom_busy_wait();
-    eeprom_read_block(profile2,(const void *)EEPROM_PROF2_ADDR,TC_NUM_PARAMS);
-
-    /* sanity check */
-    uint8_t i;
-    for (i = 0; i < TC_NUM_PARAMS; i++)
-    {
-      /* if the value is corrupt, restore the default */
-      uint8_t maxval = pgm_read_byte(&(params[i]->numvals));
-      if (profile1[i] >= maxval)
-        profile1[i] = pgm_read_byte(&(params[i]->defaultval));
-      if (profile2[i] >= maxval)
-        profile2[i] = pgm_read_byte(&(params[i]->defaultval));
-    }
+    /* data previously stored; read it. values are checked when a
+     * profile is unpacked */
+    eeprom_read_block(profiles, ee_record_addr(eeslot)+2, sizeof(profiles));
   }
+  cfg_set_profile(profilenumber);
 }
 
-void cfg_save()
+void cfg_save(void (*done)())
 {
-  eeprom_busy_wait();
-  eeprom_write_byte((uint8_t *)EEPROM_MAGIC_ADDR, EEPROM_MAGIC);
-  eeprom_busy_wait();
-  eeprom_write_block(profile1, (void *)EEPROM_PROF1_ADDR, TC_NUM_PARAMS);
-  eeprom_busy_wait();
-  eeprom_write_block(profile2, (void *)EEPROM_PROF2_ADDR, TC_NUM_PARAMS);
+  /* the record goes in the slot after the newest one, wrapping around,
+   * with the CRC written last */
+  uint16_t seq = eeseq+1;
+  memcpy(eebuf, &seq, 2);
+  memcpy(eebuf+2, profiles, sizeof(profiles));
+  eebuf[EE_RECORD_SIZE-1] = ee_crc_block(EEPROM_MAGIC, eebuf, EE_RECORD_SIZE-1);
+  eedone = done;
+  eepos = 0;
+}
+
+uint8_t cfg_saving()
+{
+  return eepos < EE_RECORD_SIZE;
+}
+
+/* polled from the main loop rather than driven by EE_READY_vect, which
+ * could fire in the middle of a line and jitter its pixels. a byte per
+ * frame is about 0.4 s for a save. */
+void cfg_service()
+{
+  if (!cfg_saving() || !eeprom_is_ready())
+    return;
+
+  uint8_t slot = (eeslot+1 < EE_NUM_SLOTS) ? eeslot+1 : 0;
+  eeprom_write_byte(ee_record_addr(slot)+eepos, eebuf[eepos]);
+  if (++eepos == EE_RECORD_SIZE)
+  {
+    eeslot = slot;
+    eeseq++;
+    if (eedone)
+      eedone();
+  }
 }
 
 void cfg_print_line(uint8_t linenum)
@@ -211,21 +375,55 @@ void cfg_print_line(uint8_t linenum)
   if (cfg_param_value(TC_LOCALECHO))
     video_putsxy(21, linenum, "LE");
 
+  if (cfg_param_value(TC_SMOOTHSCROLL))
+    video_putsxy(24, linenum, "SS");
+
+#if TILES_WIDE >= 50
   video_putsxy_P(TILES_WIDE-22, linenum, PSTR("(press NumLock to set)"));
+#else
+  video_putsxy_P(TILES_WIDE-9, linenum, PSTR("(NumLock)"));
+#endif
 }
 
 /***** Setup screen *****/
 static int8_t currparam;
 static uint8_t currprof;
+static uint8_t setupresult;
+
+/* The profile, the parameters and Save go between the borders, above the
+ * help line. They are double-spaced if there's room, and start on the
+ * first row inside the border if they have to; if they still don't clear
+ * the help line, it goes on the bottom border instead. */
+#define SETUP_LINES     (TC_NUM_PARAMS+2)
+#if 2*SETUP_LINES <= TILES_HIGH-4
+#define SETUP_TOP       2
+#define SETUP_SPACING   2
+#define SETUP_HELP_ROW  (TILES_HIGH-2)
+#elif SETUP_LINES <= TILES_HIGH-4
+#define SETUP_TOP       2
+#define SETUP_SPACING   1
+#define SETUP_HELP_ROW  (TILES_HIGH-2)
+#elif SETUP_LINES <= TILES_HIGH-3
+#define SETUP_TOP       1
+#define SETUP_SPACING   1
+#define SETUP_HELP_ROW  (TILES_HIGH-2)
+#elif SETUP_LINES <= TILES_HIGH-2
+#define SETUP_TOP       1
+#define SETUP_SPACING   1
+#define SETUP_HELP_ROW  (TILES_HIGH-1)
+#else
+#error The setup screen needs more rows than TILES_HIGH has
+#endif
 
 static void setup_print_line(int8_t param)
 {
-  uint8_t linenum = 4 + 2*param;
+  uint8_t linenum = SETUP_TOP + SETUP_SPACING*(param+1);
   video_gotoxy(0, linenum);
   video_clrline();
 
   if (param == TC_NUM_PARAMS)
-    video_putsxy(3, linenum, "Save");
+    video_putsxy_P(3, linenum,
+                   (cfg_saving()) ? PSTR("Saving...") : PSTR("Save"));
   else if (param == -1)
   {
     video_putsxy_P(3, linenum, PSTR("Profile"));
@@ -236,7 +434,8 @@ static void setup_print_line(int8_t param)
   else
   {
     video_putsxy_P(3, linenum, cfg_param_name(param));
-    video_putsxy_P(3+PARAM_NAME_LEN+3, linenum, cfg_param_value_str(param));
+    video_putsxy_P(3+PARAM_NAME_LEN+3, linenum,
+                   param_value_str(setupvals, param));
   }
 
   /* Highlight with inverse video if this parameter is selected */
@@ -272,8 +471,13 @@ void setup_redraw()
   video_putcxy(0, TILES_HIGH-1, '\x0E');
   video_putcxy(TILES_WIDE-1, TILES_HIGH-1, '\x0B');
 
-  video_putsxy_P(5, TILES_HIGH-2,
+#if TILES_WIDE >= 50
+  video_putsxy_P(5, SETUP_HELP_ROW,
       PSTR("\x03\x04: select     Enter: change     Esc: quit"));
+#else
+  video_putsxy_P(3, SETUP_HELP_ROW,
+      PSTR("\x03\x04:select Enter:change Esc:quit"));
+#endif
 }
 
 void setup_start()
@@ -282,19 +486,36 @@ void setup_start()
 
   currparam = -1;
 
-  /* copy the current settings into the temps */
-  memcpy(profile1temp, profile1, TC_NUM_PARAMS);
-  memcpy(profile2temp, profile2, TC_NUM_PARAMS);
-  config = (profilenumber) ? profile2temp : profile1temp;
+  /* copy the current settings into the temps, and edit the current
+   * profile */
+  memcpy(profilestemp, profiles, sizeof(profiles));
   currprof = profilenumber;
+  profile_unpack(setupvals, profilestemp, currprof);
+  setupresult = 0;
 
   setup_redraw();
 }
 
+static void setup_saved()
+{
+  setupresult = SETUP_SAVE;
+}
+
+uint8_t setup_poll()
+{
+  uint8_t ret = setupresult;
+  setupresult = 0;
+  return ret;
+}
+
 uint8_t setup_handle_key(uint8_t key)
 {
   uint8_t ret = 0;
 
+  /* wait for a save to finish */
+  if (cfg_saving())
+    return 0;
+
   switch (key)
   {
     case K_UP:
@@ -322,24 +543,26 @@ uint8_t setup_handle_key(uint8_t key)
       if (currparam == TC_NUM_PARAMS) /* save and quit */
       {
         /* copy the temp settings back */
-        memcpy(profile1, profile1temp, TC_NUM_PARAMS);
-        memcpy(profile2, profile2temp, TC_NUM_PARAMS);
-        config = (profilenumber) ? profile2 : profile1;
-        cfg_save();
-        ret = SETUP_SAVE;
+        profile_pack(profilestemp, currprof, setupvals);
+        memcpy(profiles, profilestemp, sizeof(profiles));
+        profile_unpack(active, profiles, profilenumber);
+        cfg_save(setup_saved);
+        setup_print_line(currparam);
       }
       else if (currparam == -1) /* change profile */
       {
-        currprof = !currprof;
-        config = (currprof) ? profile2temp : profile1temp;
+        profile_pack(profilestemp, currprof, setupvals);
+        if (++currprof == TC_NUM_PROFILES)
+          currprof = 0;
+        profile_unpack(setupvals, profilestemp, currprof);
         setup_redraw();
       }
       else
       {
         uint8_t maxval = pgm_read_byte(&(params[currparam]->numvals));
-        config[currparam]++;
-        if (config[currparam] >= maxval)
-          config[currparam] = 0;
+        setupvals[currparam]++;
+        if (setupvals[currparam] >= maxval)
+          setupvals[currparam] = 0;
         setup_print_line(currparam);
       }
       break;
@@ -347,7 +570,6 @@ uint8_t setup_handle_key(uint8_t key)
     case '\x1B': /* ESC */
     case K_NUMLK:
     {
-      config = (profilenumber) ? profile2 : profile1;
       ret = SETUP_CANCEL;
       break;
     }
@@ -362,4 +584,5 @@ void setup_leave()
   cfg_print_line(video_gety());
   video_lfwd();
   video_show_cursor();
+  perf_redraw(); /* the setup screen's border was over it */
 }
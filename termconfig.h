@@ -21,22 +21,31 @@ enum
   TC_LOCALECHO,
   TC_ESCSEQS,
   TC_REVVIDEO,
-  TC_NUM_PARAMS
+  TC_SMOOTHSCROLL,
+  TC_CURSORBLINK,
+  TC_KEYREPEAT,
+  TC_ARROWBATCH
 };
 
+/* A number rather than the end of the enum, so the preprocessor can check
+ * that the setup screen fits; keep it in step */
+#define TC_NUM_PARAMS 12
+
+#define TC_NUM_PROFILES 8
+
 #define SETUP_CANCEL  1
 #define SETUP_SAVE    2
 
 /* Get the name of the specified parameter */
 PGM_P cfg_param_name(uint8_t param);
 
-/* Get the value of the specified parameter in a configuration */
+/* Get the value of the specified parameter in the active profile */
 uint8_t cfg_param_value(uint8_t param);
 
 /* Get the string representation of the value of the specified parameter */
 PGM_P cfg_param_value_str(uint8_t param);
 
-/* Set the current profile to 0 or 1 */
+/* Set the current profile, 0 to TC_NUM_PROFILES-1 */
 void cfg_set_profile(uint8_t pn);
 
 /* Returns the current profile number */
@@ -48,8 +57,19 @@ void cfg_set_defaults();
 /* Load parameter values from EEPROM */
 void cfg_load();
 
-/* Save parameter values to EEPROM */
-void cfg_save();
+/* Save parameter values to EEPROM. The values are copied, and written in
+ * the background a byte per call to cfg_service(); done (if not NULL) is
+ * called once they have all been written. Saving again before that starts
+ * over. */
+void cfg_save(void (*done)());
+
+/* Returns true while a save is being written */
+uint8_t cfg_saving();
+
+/* Writes the next byte of a save if the EEPROM is ready. Call once per
+ * frame; each byte takes about 3.3 ms to write, which happens while the
+ * next frame is drawn. */
+void cfg_service();
 
 /* Print the configuration summary at the specified line */
 void cfg_print_line(uint8_t linenum);
@@ -63,6 +83,10 @@ void setup_redraw();
 /* Handle keystrokes on the setup screen */
 uint8_t setup_handle_key(uint8_t key);
 
+/* Returns SETUP_SAVE once a save started from the setup screen has been
+ * written, otherwise 0. The setup screen stays up until then. */
+uint8_t setup_poll();
+
 /* Leave the setup screen */
 void setup_leave();
 #endif
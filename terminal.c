@@ -9,6 +9,11 @@
 #include "video.h"
 #include "keycodes.h"
 #include "termconfig.h"
+#include "latency.h"
+#include "perf.h"
+#include "frameprof.h"
+#include "linkstats.h"
+#include "report.h"
 
 #include <avr/interrupt.h>
 #include <util/atomic.h>
@@ -53,6 +58,10 @@ enum
   ESC_GOT_1B,
   ESC_CSI,
   ESC_NONCSI,
+  ESC_DCS,        /* ESC P; collecting parameters */
+  ESC_DCS_DSCS,   /* DECDLD; waiting for the character set name */
+  ESC_DCS_DATA,   /* DECDLD; receiving sixels */
+  ESC_DCS_IGNORE, /* unsupported DCS; swallow until ST */
 };
 
 typedef struct
@@ -60,33 +69,54 @@ typedef struct
   int8_t cx;
   int8_t cy;
   uint8_t graphicchars;
-  uint8_t revvideo;
+  uint8_t rendition;
 } termstate_t;
 
 /* setup screen active? */
 static bool in_setup;
 
 /* circular UART buffer */
-#define MAX_BUF 254
+#define MAX_BUF RX_BUF_SIZE /* sized by defs.h from the geometry */
 volatile uint8_t bufsize;
 volatile uint8_t buf[MAX_BUF];
 volatile uint8_t bufhead;
 volatile uint8_t buftail;
 
+#ifdef REPLY_QUEUE
+/* replies waiting for the transmitter */
+static uint8_t replybuf[REPLY_BUF_SIZE];
+static volatile uint8_t replyhead;
+static volatile uint8_t replytail;
+#endif
+
 /* escape sequence processing */
 static uint8_t in_esc;
 static char paramstr[MAX_ESC_LEN+1];
 static char *paramptr;
 static uint8_t paramch;
 
+/* soft font (DECDLD) loading */
+static uint8_t softglyph;     /* glyph being loaded */
+static uint8_t softcol;       /* sixel column within the glyph */
+static uint8_t softsixelrow;  /* pixel row of the top of the current sixels */
+static bool softdata;         /* received any glyph data */
+
 /* parameters from setup */
 static uint8_t newlineseq;
 static uint8_t process_escseqs;
 static uint8_t local_echo;
-
-/* current attributes */
+static uint8_t counted_arrows;
+static uint8_t profsw;          /* last position of the profile switch */
+
+/* current attributes. Blink is only shown by builds with a blink plane
+ * (ATTR_BLINK in defs.h), and is ignored by the others; the two are kept
+ * apart so that ending one doesn't end the other. */
+#define SGR_REVERSE 0x01
+#define SGR_BLINK   0x02
 static uint8_t graphicchars;  /* set to 1 with an SI and set to 0 with an SO */
-static uint8_t revvideo;      /* reverse video attribute */
+static uint8_t rendition;     /* SGR_REVERSE and SGR_BLINK */
+static uint8_t revvideo;      /* cell attributes, from rendition */
+static uint8_t appcursor;     /* DECCKM: arrows send SS3, not CSI */
 static termstate_t savedstate;/* state used for save/restore sequences */
 
 /* prototypes */
@@ -94,12 +124,20 @@ void escseq_process(char c);
 void escseq_process_noncsi(char c);
 void escseq_process_csi(char c);
 void escseq_csi_start();
+void escseq_process_dcs(char c);
+void escseq_process_sixel(char c);
+void escseq_dcs_end();
 uint8_t escseq_get_param(uint8_t defaultval);
+int8_t escseq_get_int8(uint8_t defaultval);
 void receive_char(uint8_t c);
+void set_revvideo();
 void save_term_state();
 void restore_term_state();
 void reset_term();
+void setup_finish(uint8_t finish);
+void select_profile(uint8_t prof);
 extern uint16_t frame;
+extern uint8_t kbsettings;
 
 void buf_clear()
 {
@@ -115,6 +153,12 @@ void buf_enqueue(uint8_t c)
       buf[buftail] = c;
       if (++buftail >= MAX_BUF) buftail = 0;
       bufsize++;
+      perf_enqueued(bufsize);
+    }
+    else
+    {
+      perf_dropped();
+      link_dropped();
     }
   }
 }
@@ -227,7 +271,12 @@ void uart_init()
     default: uart_38400(); break;
   }
 
-  /* enable rx/tx, and interrupt */
+  /* enable rx/tx, and interrupt; a reply still queued is dropped, with
+   * the transmit interrupt off first so it can't move replyhead meanwhile */
+#ifdef REPLY_QUEUE
+  UCSR0B &= ~_BV(UDRIE0);
+  replyhead = replytail;
+#endif
   UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
 
   /* set data bits, parity, and stop bits */
@@ -238,23 +287,51 @@ void uart_init()
 
 void uart_putchar(char c)
 {
+#ifdef REPLY_QUEUE
+  while (replyhead != replytail); /* don't split a reply */
+#endif
   loop_until_bit_is_set(UCSR0A, UDRE0);
   UDR0 = c;
+  lat_tx(c);
   if (local_echo)
     receive_char(c);
 }
 
+/* Replies to the host aren't echoed, so they can't be taken for a query
+ * themselves. They are queued and sent by the transmit interrupt, so a
+ * report doesn't stop the main loop for as long as it takes to send; only
+ * a reply that doesn't fit waits for room. */
+#ifdef REPLY_QUEUE
+void uart_reply(char c)
+{
+  uint8_t next = (replytail+1) & (REPLY_BUF_SIZE-1);
+  while (next == replyhead);
+  replybuf[replytail] = c;
+  replytail = next;
+  UCSR0B |= _BV(UDRIE0);
+}
+
+ISR(USART_UDRE_vect)
+{
+  UDR0 = replybuf[replyhead];
+  replyhead = (replyhead+1) & (REPLY_BUF_SIZE-1);
+  if (replyhead == replytail)
+    UCSR0B &= ~_BV(UDRIE0);
+}
+#endif
+
 void uart_getchar()
 {
-  //volatile uint8_t c = UDR0;
-  //receive_char(c);
-  buf_enqueue(UDR0);
+  link_rx(UCSR0A); /* the error flags are for the byte in UDR0 */
+  uint8_t c = UDR0;
+  lat_rx(c);
+  buf_enqueue(c);
 }
 
 void uart_getchar2()
 {
   if (UCSR0A & _BV(RXC0))
-    buf_enqueue(UDR0);
+    uart_getchar();
 }
 
 ISR(USART_RX_vect)
@@ -265,6 +342,7 @@ ISR(USART_RX_vect)
 
 void receive_char(uint8_t c)
 {
+  lat_print(c);
   if (!process_escseqs)
   {
     video_putc_raw(c);
@@ -306,8 +384,12 @@ void receive_char(uint8_t c)
         {
           if (graphicchars && c >= '_' && c <= '~')
             c -= 95;
+#ifdef FONT_6x8_FULL
+          video_putc_raw_attr(c, revvideo);
+#else
           c |= revvideo;
           video_putc_raw(c);
+#endif
         }
     }
   }
@@ -319,12 +401,33 @@ void escseq_process(char c)
   /* CAN and SUB interrupt escape sequences */
   if (c == 0x18 || c == 0x1A)
   {
+    link_esc_cancelled();
     in_esc = NOT_IN_ESC;
     return;
   }
 
+  /* ESC terminates a device control string (normally as part of ST) */
+  if (c == 0x1B && in_esc >= ESC_DCS)
+  {
+    escseq_dcs_end();
+    in_esc = ESC_GOT_1B;
+    return;
+  }
+
   if (in_esc == ESC_CSI)
     escseq_process_csi(c);
+  else if (in_esc == ESC_DCS)
+    escseq_process_dcs(c);
+  else if (in_esc == ESC_DCS_DSCS)
+  {
+    /* skip intermediates up to the final character of the set name */
+    if (c >= 0x30)
+      in_esc = ESC_DCS_DATA;
+  }
+  else if (in_esc == ESC_DCS_DATA)
+    escseq_process_sixel(c);
+  else if (in_esc == ESC_DCS_IGNORE)
+    return;
   else if (in_esc == ESC_NONCSI)
   {
     /* received a non-CSI sequence that requires a parameter
@@ -348,6 +451,10 @@ void escseq_process_noncsi(char c)
       escseq_csi_start();
       in_esc = ESC_CSI;
       break;
+    case 'P': /* device control string */
+      escseq_csi_start();
+      in_esc = ESC_DCS;
+      break;
     case '%': /* non-CSI codes that require parameters */
     case '#': /* (we don't support these) */
     case '(':
@@ -375,6 +482,7 @@ void escseq_process_noncsi(char c)
       goto esc_done;
     case 'c': /* reset */
       video_clrscr();
+      video_softglyphs_off();
       reset_term();
       goto esc_done;
     default: /* other non-CSI codes */
@@ -392,6 +500,7 @@ void escseq_process_csi(char c)
     /* save the character */
     if (paramch >= MAX_ESC_LEN) /* received too many characters */
     {
+      link_esc_too_long();
       in_esc = NOT_IN_ESC;
       return;
     }
@@ -404,32 +513,32 @@ void escseq_process_csi(char c)
     switch (c)
     {
       case 'A': /* cursor up */
-        video_movey(-escseq_get_param(1));
+        video_movey(-escseq_get_int8(1));
         break;
       case 'B': /* cursor down */
-        video_movey(escseq_get_param(1));
+        video_movey(escseq_get_int8(1));
         break;
       case 'C': /* cursor forward */
-        video_movex(escseq_get_param(1));
+        video_movex(escseq_get_int8(1));
         break;
       case 'D': /* cursor back */
-        video_movex(-escseq_get_param(1));
+        video_movex(-escseq_get_int8(1));
         break;
       case 'E': /* cursor to next line */
-        video_movey(escseq_get_param(1));
+        video_movey(escseq_get_int8(1));
         video_movesol();
         break;
       case 'F': /* cursor to previous line */
-        video_movey(-escseq_get_param(1));
+        video_movey(-escseq_get_int8(1));
         video_movesol();
         break;
       case 'G': /* cursor horizontal absolute */
-        video_setx(escseq_get_param(1)-1); /* one-indexed */
+        video_setx(escseq_get_int8(1)-1); /* one-indexed */
         break;
       case 'H': case 'f': /* horizonal and vertical position */
       {
-        uint8_t y = escseq_get_param(1);
-        uint8_t x = escseq_get_param(1);
+        int8_t y = escseq_get_int8(1);
+        int8_t x = escseq_get_int8(1);
         video_gotoxy(x-1, y-1);
         break;
       }
@@ -443,16 +552,71 @@ void escseq_process_csi(char c)
         while (paramptr) /* read attributes until we reach the end */
         {
           uint8_t attr = escseq_get_param(0);
-          if (attr == 0 || attr == 27)
-            revvideo = 0;
+          if (attr == 0)
+            rendition = 0;
+          else if (attr == 5)
+            rendition |= SGR_BLINK;
           else if (attr == 7)
-            revvideo = 0x80;
+            rendition |= SGR_REVERSE;
+          else if (attr == 25)
+            rendition &= ~SGR_BLINK;
+          else if (attr == 27)
+            rendition &= ~SGR_REVERSE;
+        }
+        set_revvideo();
+        break;
+      case 'h': /* set mode */
+      case 'l': /* reset mode */
+        if (paramstr[0] == '?') /* DEC private modes */
+        {
+          paramptr++;
+          while (paramptr)
+          {
+            uint8_t mode = escseq_get_param(0);
+            if (mode == 1) /* DECCKM */
+              appcursor = (c == 'h');
+            else if (mode == 4) /* DECSCLM */
+              video_set_smooth_scroll(c == 'h');
+            else if (mode == 12) /* blinking cursor */
+              video_set_cursor_blink(c == 'h');
+            else if (mode == 92) /* private: performance overlay */
+              perf_show(c == 'h');
+          }
+        }
+        break;
+      case 'n': /* device status report */
+        if (paramstr[0] == '?') /* private: diagnostics */
+        {
+          paramptr++;
+          uint8_t report = escseq_get_param(0);
+          if (report == 90)
+            lat_report();
+          else if (report == 91)
+            lat_reset();
+          else if (report == 93)
+            fp_report();
+          else if (report == 94)
+            fp_reset();
+          else if (report == 95)
+            link_report();
+          else if (report == 96)
+            link_reset();
+        }
+        break;
+      case 'p': /* private: select profile */
+        if (paramstr[0] == '?')
+        {
+          /* 1 to TC_NUM_PROFILES, or 0 for the one the switch selects */
+          paramptr++;
+          uint8_t prof = escseq_get_param(0);
+          if (prof <= TC_NUM_PROFILES)
+            select_profile((prof) ? prof-1 : profsw);
         }
         break;
       case 'r': /* set top and bottom margins */
       {
-        uint8_t top = escseq_get_param(1);
-        uint8_t bottom = escseq_get_param(TILES_HIGH);
+        int8_t top = escseq_get_int8(1);
+        int8_t bottom = escseq_get_int8(TILES_HIGH);
         video_set_margins(top-1, bottom-1);
         break;
       }
@@ -464,6 +628,65 @@ void escseq_process_csi(char c)
   }
 }
 
+/* Process sequences that begin with ESC P.
+ * Only DECDLD is supported:
+ *   ESC P Pfn;Pcn;Pe;Pcmw;Pss;Pt;Pcmh;Pcss { Dscs sixels ST
+ * Glyph n replaces the font pattern for character 0x20+Pcn+n. There is
+ * only one soft font, so every DECDLD replaces it entirely; Pe and the
+ * cell size parameters are ignored. A DECDLD without glyph data turns the
+ * soft font off. */
+void escseq_process_dcs(char c)
+{
+  if ((c >= '0' && c <= '9') || c == ';') /* digit or separator */
+  {
+    if (paramch >= MAX_ESC_LEN) /* received too many characters */
+    {
+      link_esc_too_long();
+      in_esc = ESC_DCS_IGNORE;
+      return;
+    }
+    paramstr[paramch] = c;
+    paramch++;
+  }
+  else if (c == '{') /* DECDLD */
+  {
+    escseq_get_param(0); /* font number */
+    uint8_t first = escseq_get_param(0);
+    /* video_softglyphs_on() moves a set that doesn't fit down */
+    video_softglyphs_on((first < 0x100-' ') ? ' '+first : 0xFF);
+    softglyph = softcol = softsixelrow = 0;
+    softdata = false;
+    in_esc = ESC_DCS_DSCS;
+  }
+  else
+    in_esc = ESC_DCS_IGNORE;
+}
+
+void escseq_process_sixel(char c)
+{
+  if (c >= '?' && c <= '~')
+  {
+    video_softglyph_sixel(softglyph, softcol++, softsixelrow, c-'?');
+    softdata = true;
+  }
+  else if (c == '/') /* next sixel row */
+  {
+    softcol = 0;
+    softsixelrow += 6;
+  }
+  else if (c == ';') /* next glyph */
+  {
+    softglyph++;
+    softcol = softsixelrow = 0;
+  }
+}
+
+void escseq_dcs_end()
+{
+  if ((in_esc == ESC_DCS_DSCS || in_esc == ESC_DCS_DATA) && !softdata)
+    video_softglyphs_off();
+}
+
 void escseq_csi_start()
 {
   paramch = 0;
@@ -483,7 +706,7 @@ uint8_t escseq_get_param(uint8_t defaultval)
   char *endptr = strchr(paramptr, ';');
   if (endptr)
   {
-    *endptr = '\0'; /* replace the semicolon to make atoi stop here */
+    *endptr = '\0'; /* end this parameter at the semicolon */
     paramptr = endptr+1;
   }
   else
@@ -491,32 +714,58 @@ uint8_t escseq_get_param(uint8_t defaultval)
 
   /* ascii to integer, as long as the string isn't empty */
   /* default value is given if the string is empty */
+  /* values that don't fit in a byte are 255, not the low 8 bits */
   if (*startptr)
-    val = atoi(startptr); /* will read up to the null */
-  
+  {
+    val = 0;
+    for (; *startptr >= '0' && *startptr <= '9'; startptr++)
+    {
+      uint8_t d = *startptr - '0';
+      val = (val > 25 || (val == 25 && d > 5)) ? 255 : val*10 + d;
+    }
+  }
 
   return val;
 }
 
+/* For parameters passed on as an int8_t; anything over 127 is more than
+ * the screen is wide or high anyway. */
+int8_t escseq_get_int8(uint8_t defaultval)
+{
+  uint8_t val = escseq_get_param(defaultval);
+  return (val > 127) ? 127 : val;
+}
+
+void set_revvideo()
+{
+  revvideo = (rendition & SGR_REVERSE) ? 0x80 : 0;
+#ifdef ATTR_BLINK
+  if (rendition & SGR_BLINK)
+    revvideo |= VIDEO_BLINK;
+#endif
+}
+
 void save_term_state()
 {
   savedstate.cx = video_getx();
   savedstate.cy = video_gety();
   savedstate.graphicchars = graphicchars;
-  savedstate.revvideo = revvideo;
+  savedstate.rendition = rendition;
 }
 
 void restore_term_state()
 {
   video_gotoxy(savedstate.cx, savedstate.cy);
   graphicchars = savedstate.graphicchars;
-  revvideo = savedstate.revvideo;
+  rendition = savedstate.rendition;
+  set_revvideo();
 }
 
 void reset_term()
 {
   graphicchars = 0;
-  revvideo = 0;
+  rendition = revvideo = 0;
+  appcursor = 1;  /* arrows have always sent SS3 */
   in_esc = 0;
   save_term_state();
 }
@@ -526,11 +775,18 @@ void apply_config()
   uart_init();
   
   video_set_reverse(cfg_param_value(TC_REVVIDEO));
+  video_set_smooth_scroll(cfg_param_value(TC_SMOOTHSCROLL));
+  video_set_cursor_blink(cfg_param_value(TC_CURSORBLINK));
 
   /* cache the values from the config struct */
   newlineseq = cfg_param_value(TC_ENTERCHAR);
   process_escseqs = cfg_param_value(TC_ESCSEQS);
   local_echo = cfg_param_value(TC_LOCALECHO);
+  counted_arrows = cfg_param_value(TC_ARROWBATCH);
+
+  /* the keyboard buffer picks these up with its next frame */
+  kbsettings = KB_SET_MARK | cfg_param_value(TC_KEYREPEAT) |
+               cfg_param_value(TC_ARROWBATCH);
 }
 
 void app_setup()
@@ -543,8 +799,8 @@ void app_setup()
 
   reset_term();
 
-  uint8_t prof = (PIN(PROFILE_SW) & _BV(PROFILE_SW_PIN)) != 0;
-  cfg_set_profile(prof);
+  profsw = (PIN(PROFILE_SW) & _BV(PROFILE_SW_PIN)) != 0;
+  cfg_set_profile(profsw);
   cfg_load();
   apply_config();
   
@@ -561,21 +817,48 @@ uint8_t app_main_loop()
   if ((frame & 0b11) == 0b11)
   {
     /* check every 4th frame to debounce */
+    /* the switch picks profile 1 or 2 when it's moved, overriding any
+     * profile selected with an escape sequence */
     uint8_t prof = (PIN(PROFILE_SW) & _BV(PROFILE_SW_PIN)) != 0;
-    if (prof != cfg_profile())
+    if (prof != profsw)
     {
-      cfg_set_profile(prof);
-      apply_config();
-      if (in_setup)
-        setup_redraw();
-      else
+      profsw = prof;
+      select_profile(prof);
+      if (!in_setup)
         setup_leave(); /* used to re-print the welcome screen */
     }
   }
 
+  /* write a byte of a pending save; the setup screen is left once a save
+   * from it has been written */
+  cfg_service();
+  if (in_setup)
+    setup_finish(setup_poll());
+  else
+    perf_frame();
+
+  /* Smooth scrolling holds off printing until the line has scrolled into
+   * place, unless the receive buffer is filling up. Then every line fed
+   * this frame is finished straight away and the buffer is emptied, since
+   * a frame's worth of bytes at a high baud rate may not fit in what's
+   * left of it. */
+  uint8_t catchup = buf_size() >= MAX_BUF/2;
+  if (catchup)
+    video_scroll_finish();
+  else
+    video_scroll_step();
+
   /* print characters waiting in the receive buffer */
   while (bufsize)
+  {
+    if (video_scrolling())
+    {
+      if (!catchup)
+        break;
+      video_scroll_finish();
+    }
     receive_char(buf_dequeue());
+  }
 
   return 0;
 }
@@ -590,7 +873,13 @@ void send_newline()
 
 void send_special_key(uint8_t key)
 {
-  if (key >= K_F1 && key <= K_PGDN)
+  if (key >= K_UP && key <= K_RIGHT && !appcursor)
+  {
+    uart_putchar('\x1B');
+    uart_putchar('[');
+    uart_putchar(pgm_read_byte(&specialkeyseqs[key-K_F1][2]));
+  }
+  else if (key >= K_F1 && key <= K_PGDN)
   {
     PGM_P seq = specialkeyseqs[key-K_F1];
     char c;
@@ -599,19 +888,29 @@ void send_special_key(uint8_t key)
   }
 }
 
-void app_handle_key(uint8_t key)
+void select_profile(uint8_t prof)
 {
+  cfg_set_profile(prof);
+  apply_config();
   if (in_setup)
+    setup_redraw();
+}
+
+void setup_finish(uint8_t finish)
+{
+  if (finish)
   {
-    uint8_t finish = setup_handle_key(key);
-    if (finish)
-    {
-      in_setup = false;
-      if (finish == SETUP_SAVE) /* need to reapply settings */
-        apply_config();
-      setup_leave();
-    }
+    in_setup = false;
+    if (finish == SETUP_SAVE) /* need to reapply settings */
+      apply_config();
+    setup_leave();
   }
+}
+
+void app_handle_key(uint8_t key)
+{
+  if (in_setup)
+    setup_finish(setup_handle_key(key));
   else
   {
     if (key == K_NUMLK) /* start setup */
@@ -619,6 +918,8 @@ void app_handle_key(uint8_t key)
       in_setup = true;
       setup_start();
     }
+    else if (key == K_SCRLK) /* show or hide the performance overlay */
+      perf_toggle();
     else if (key == '\n') /* send appropriate newline sequence */
       send_newline();
     else if (key >= 0x80) /* special keys */
@@ -628,3 +929,25 @@ void app_handle_key(uint8_t key)
   }
 }
 
+void app_handle_keys(uint8_t key, uint8_t count)
+{
+  /* a held arrow key can be sent as one CSI n A/B/C/D instead of a
+   * sequence per repeat, if the keyboard buffer is set to queue arrow
+   * repeats in batches so they arrive together. SS3 takes no count, so
+   * with DECCKM set each repeat is sent on its own */
+  if (counted_arrows && count > 1 && !in_setup && !appcursor &&
+      key >= K_UP && key <= K_RIGHT)
+  {
+    /* count is at most KB_FRAME_MAX, a single digit */
+    uart_putchar('\x1B');
+    uart_putchar('[');
+    uart_putchar('0'+count);
+    uart_putchar(pgm_read_byte(&specialkeyseqs[key-K_F1][2]));
+  }
+  else
+  {
+    while (count--)
+      app_handle_key(key);
+  }
+}
+
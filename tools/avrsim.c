@@ -0,0 +1,1226 @@
+/* ATmega328P simulator for the Terminalscope firmware
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Runs main.elf instruction by instruction with AVR cycle counts, along
+ * with just enough of the peripherals the firmware uses: timers 0 and 1
+ * (CTC mode and their compare A flags), the USART (receive FIFO and overrun, transmitter
+ * always ready), the SPI master (the keyboard buffer always answers 0),
+ * the EEPROM (with its write time) and the interrupts for those.
+ *
+ * Bytes from a file are fed to the receiver at the given baud rate. The
+ * video pin (PORTB bit 0) is sampled every PIXEL_CYCLES from the first
+ * write after HSYNC falls until HSYNC rises, and each frame between VSYNC
+ * falling and rising is written as an ASCII PGM like fonts/6x8font.pgm.
+ *
+ * Reports receive bytes lost to overruns, frames that started late
+ * (the main loop ran past the frame timer) and frame timer periods that
+ * went by without a frame at all. With -p, also reports the calls to the
+ * named functions (found in the ELF symbol table) and the cycles each
+ * took, from the call to the return, less any interrupts taken meanwhile.
+ *
+ * Built and run by "make sim"; see the Makefile for the options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "../defs.h"
+
+#define FLASH_SIZE    32768
+#define DATA_SIZE     0x900   /* registers, I/O and 2K of SRAM */
+#define EEPROM_SIZE   1024
+#define EE_WRITE_CYCLES ((uint64_t)F_CPU*34/10000) /* 3.4 ms */
+
+/* data space addresses */
+#define PINB    0x23
+#define PORTB   0x25
+#define PORTC   0x28
+#define PIND    0x29
+#define TIFR0   0x35
+#define TIFR1   0x36
+#define EECR    0x3F
+#define EEDR    0x40
+#define EEARL   0x41
+#define EEARH   0x42
+#define TCCR0A  0x44
+#define TCCR0B  0x45
+#define TCNT0   0x46
+#define OCR0A   0x47
+#define SPCR    0x4C
+#define SPSR    0x4D
+#define SPDR    0x4E
+#define SPL     0x5D
+#define SPH     0x5E
+#define SREG    0x5F
+#define TIMSK0  0x6E
+#define TIMSK1  0x6F
+#define TCCR1B  0x81
+#define TCNT1L  0x84
+#define TCNT1H  0x85
+#define OCR1AL  0x88
+#define OCR1AH  0x89
+#define OCR1BL  0x8A
+#define OCR1BH  0x8B
+#define UCSR0A  0xC0
+#define UCSR0B  0xC1
+#define UBRR0L  0xC4
+#define UBRR0H  0xC5
+#define UDR0    0xC6
+
+/* SREG bits */
+#define SC 0
+#define SZ 1
+#define SN 2
+#define SV 3
+#define SS 4
+#define SH 5
+#define ST 6
+#define SI 7
+
+/* interrupt vectors */
+#define VEC_TIMER1_COMPA  11
+#define VEC_TIMER0_COMPA  14
+#define VEC_SPI_STC       17
+#define VEC_USART_RX      18
+#define VEC_USART_UDRE    19
+#define VEC_EE_READY      22
+
+/* a frame that starts more than this long after the frame timer fires
+ * was held up by the main loop */
+#define LATE_CYCLES 16
+
+static uint16_t flash[FLASH_SIZE/2];
+static uint8_t data[DATA_SIZE];
+static uint8_t eeprom[EEPROM_SIZE];
+static uint16_t pc;
+static uint64_t cycles;
+static uint8_t irqhold;     /* instructions to run before taking interrupts */
+static uint8_t sleeping;
+
+#define R (data)            /* registers are the first 32 bytes */
+#define SREGBITS data[SREG]
+
+/***** Peripherals *****/
+
+/* timer 0 */
+static uint32_t t0prescount;
+
+/* timer 1 */
+static uint8_t t1temp;      /* high byte latch for 16-bit access */
+static uint32_t t1prescount;
+static uint64_t t1match;    /* when OCF1A was last set */
+
+/* USART */
+static uint8_t rxfifo[2];
+static uint8_t rxcount;
+static unsigned long rxdropped, rxbytes, txbytes;
+static FILE *txfile;
+
+/* SPI */
+static uint64_t spidone;    /* when the transfer in progress ends, or 0 */
+
+/* EEPROM */
+static uint64_t eedone;     /* when the write in progress ends, or 0 */
+
+/* frames */
+static unsigned long frames, lateframes, skippedframes;
+static uint64_t worstlate;
+
+/* profiled functions (-p), and the calls to them and interrupts under way,
+ * innermost last. A call ends at the RET that pops its return address, so
+ * a frame is matched by the stack pointer below that address. */
+#define MAX_PROFILED  16
+#define MAX_DEPTH     32
+#define PROF_ISR      -1
+typedef struct
+{
+  const char *name;
+  int32_t addr;             /* word address, or -1 if not in the ELF file */
+  unsigned long calls;
+  uint64_t cycles, maxcycles;
+} profile_t;
+static profile_t profiled[MAX_PROFILED];
+static int numprofiled;
+static struct
+{
+  int8_t fn;                /* index into profiled, or PROF_ISR */
+  uint16_t sp;
+  uint64_t start, isrstart;
+} callstack[MAX_DEPTH];
+static int depth;
+static uint64_t isrcycles;  /* cycles spent in interrupt handlers */
+
+static uint16_t rd16(uint8_t lo)
+{
+  return data[lo] | data[lo+1] << 8;
+}
+
+static uint8_t spi_divider()
+{
+  static const uint8_t div[4] = { 4, 16, 64, 128 };
+  uint8_t d = div[data[SPCR] & 3];
+  return (data[SPSR] & 1) ? d/2 : d;
+}
+
+static void video_write(uint8_t addr, uint8_t old, uint8_t val);
+
+static uint8_t io_read(uint16_t addr)
+{
+  uint8_t v;
+  switch (addr)
+  {
+    case TCNT1L:
+      t1temp = data[TCNT1H];
+      return data[TCNT1L];
+    case TCNT1H:
+      return t1temp;
+    case UCSR0A:
+      v = data[UCSR0A] & ~0x80;
+      return (rxcount) ? v | 0x80 : v;
+    case UDR0:
+      if (!rxcount)
+        return 0;
+      v = rxfifo[0];
+      rxfifo[0] = rxfifo[1];
+      rxcount--;
+      return v;
+    case SPDR:
+      data[SPSR] &= ~0x80;
+      return 0; /* nothing from the keyboard buffer */
+    case EECR:
+      return (eedone) ? data[EECR] | 0x02 : data[EECR] & ~0x02;
+  }
+  return data[addr];
+}
+
+static void io_write(uint16_t addr, uint8_t val)
+{
+  uint8_t old = data[addr];
+  switch (addr)
+  {
+    case TIFR0: /* writing a 1 clears a flag */
+      data[addr] = old & ~val;
+      return;
+    case TIFR1:
+      if (val & 0x02 & old)
+      {
+        uint64_t late = cycles - t1match;
+        frames++;
+        if (late > LATE_CYCLES)
+          lateframes++;
+        if (late > worstlate)
+          worstlate = late;
+      }
+      data[addr] = old & ~val;
+      return;
+    case TCNT1H:
+    case OCR1AH:
+    case OCR1BH:
+      t1temp = val;
+      return;
+    case TCNT1L:
+    case OCR1AL:
+    case OCR1BL:
+      data[addr] = val;
+      data[addr+1] = t1temp;
+      return;
+    case UDR0:
+      txbytes++;
+      if (txfile)
+        fputc(val, txfile);
+      return;
+    case SPDR:
+      data[SPDR] = val;
+      spidone = cycles + 8*spi_divider();
+      return;
+    case EECR:
+      if ((val & 0x01) && !eedone) /* EERE */
+        data[EEDR] = eeprom[rd16(EEARL) & (EEPROM_SIZE-1)];
+      if ((val & 0x02) && (old & 0x04) && !eedone) /* EEPE after EEMPE */
+      {
+        eeprom[rd16(EEARL) & (EEPROM_SIZE-1)] = data[EEDR];
+        eedone = cycles + EE_WRITE_CYCLES;
+        val &= ~0x04;
+      }
+      data[EECR] = val & ~0x03;
+      return;
+    case PORTB:
+    case PORTC:
+      data[addr] = val;
+      video_write(addr, old, val);
+      return;
+  }
+  data[addr] = val;
+}
+
+static uint8_t mem_read(uint16_t addr)
+{
+  if (addr >= DATA_SIZE)
+    return 0;
+  if (addr >= 0x20 && addr < 0x100)
+    return io_read(addr);
+  return data[addr];
+}
+
+static void mem_write(uint16_t addr, uint8_t val)
+{
+  if (addr >= DATA_SIZE)
+    return;
+  if (addr >= 0x20 && addr < 0x100)
+    io_write(addr, val);
+  else
+    data[addr] = val;
+}
+
+/* advance the peripherals by n cycles */
+static void tick(uint8_t n)
+{
+  static const uint16_t prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  uint16_t ps = prescale[data[TCCR1B] & 7];
+  uint16_t ps0 = prescale[data[TCCR0B] & 7];
+
+  cycles += n;
+
+  t0prescount += n;
+  while (ps0 && t0prescount >= ps0)
+  {
+    t0prescount -= ps0;
+    if (data[TCNT0] == data[OCR0A])
+    {
+      data[TIFR0] |= 0x02;
+      if (data[TCCR0A] & 0x02) /* CTC */
+        data[TCNT0] = 0xFF;
+    }
+    data[TCNT0]++;
+  }
+
+  t1prescount += n;
+  while (ps && t1prescount >= ps)
+  {
+    t1prescount -= ps;
+    uint16_t tcnt = rd16(TCNT1L);
+    uint16_t ocr = rd16(OCR1AL);
+    if (tcnt == ocr)
+    {
+      if (data[TIFR1] & 0x02)
+        skippedframes++;
+      data[TIFR1] |= 0x02;
+      t1match = cycles;
+      if (data[TCCR1B] & 0x08) /* CTC */
+        tcnt = 0xFFFF;
+    }
+    tcnt++;
+    data[TCNT1L] = tcnt;
+    data[TCNT1H] = tcnt >> 8;
+  }
+
+  if (spidone && cycles >= spidone)
+  {
+    spidone = 0;
+    data[SPSR] |= 0x80;
+  }
+  if (eedone && cycles >= eedone)
+    eedone = 0;
+}
+
+static void rx_byte(uint8_t c)
+{
+  rxbytes++;
+  if (!(data[UCSR0B] & 0x10) || rxcount == 2) /* disabled, or overrun */
+  {
+    data[UCSR0A] |= 0x08;
+    rxdropped++;
+    return;
+  }
+  rxfifo[rxcount++] = c;
+}
+
+/* baud rate the USART is set to */
+static unsigned long usart_baud()
+{
+  uint16_t ubrr = rd16(UBRR0L) & 0x0FFF;
+  return F_CPU / (((data[UCSR0A] & 0x02) ? 8UL : 16UL) * (ubrr+1));
+}
+
+/***** Video *****/
+
+static uint8_t frame_pixels[NUM_LINES][PIXELS_WIDE];
+static int line, inframe, inline_, col;
+static uint64_t nextpixel;
+static uint8_t videobit;
+static char *outprefix;
+static unsigned long outevery = 1, written;
+
+/* sample the video pin up to now */
+static void video_sample()
+{
+  while (inline_ && nextpixel <= cycles)
+  {
+    if (col < PIXELS_WIDE && line < NUM_LINES)
+      frame_pixels[line][col] = videobit;
+    col++;
+    nextpixel += PIXEL_CYCLES;
+  }
+}
+
+static void write_frame()
+{
+  char name[512];
+  int x, y;
+  snprintf(name, sizeof(name), "%s%04lu.pgm", outprefix, frames);
+  FILE *f = fopen(name, "w");
+  if (!f)
+  {
+    perror(name);
+    exit(1);
+  }
+  fprintf(f, "P2\n# avrsim frame %lu\n%d %d\n255\n", frames, PIXELS_WIDE,
+          NUM_LINES);
+  for (y = 0; y < NUM_LINES; y++)
+    for (x = 0; x < PIXELS_WIDE; x++)
+      fprintf(f, "%d\n", (frame_pixels[y][x]) ? 255 : 0);
+  fclose(f);
+  written++;
+}
+
+static void video_write(uint8_t addr, uint8_t old, uint8_t val)
+{
+  uint8_t changed = old ^ val;
+  if (addr == PORTB)
+  {
+    video_sample();
+    if (!inline_ && inframe && col == -1) /* first pixel of a line */
+    {
+      inline_ = 1;
+      col = 0;
+      nextpixel = cycles + PIXEL_CYCLES/2; /* sample mid-pixel */
+    }
+    videobit = val & (1 << VIDEO_OUT_PIN);
+    return;
+  }
+
+  /* sync port */
+  if ((changed & (1 << HSYNC_PIN)) && inframe)
+  {
+    if (!(val & (1 << HSYNC_PIN))) /* start of a line */
+    {
+      memset(frame_pixels[line < NUM_LINES ? line : NUM_LINES-1], 0,
+             PIXELS_WIDE);
+      col = -1;
+    }
+    else if (inline_ || col == -1) /* end of a line */
+    {
+      video_sample();
+      inline_ = 0;
+      col = 0;
+      line++;
+    }
+  }
+  if (changed & (1 << VSYNC_PIN))
+  {
+    if (!(val & (1 << VSYNC_PIN))) /* start of a frame */
+    {
+      inframe = 1;
+      line = 0;
+      inline_ = 0;
+      col = (val & (1 << HSYNC_PIN)) ? 0 : -1; /* HSYNC may already be low */
+    }
+    else if (inframe) /* end of a frame */
+    {
+      inframe = 0;
+      if (line != NUM_LINES)
+        fprintf(stderr, "frame %lu has %d lines, not %d\n", frames, line,
+                NUM_LINES);
+      if (outprefix && frames % outevery == 0)
+        write_frame();
+    }
+  }
+}
+
+/***** Profiling *****/
+
+static void prof_push(int8_t fn)
+{
+  if (depth == MAX_DEPTH)
+    return;
+  callstack[depth].fn = fn;
+  callstack[depth].sp = rd16(SPL);
+  callstack[depth].start = cycles;
+  callstack[depth].isrstart = isrcycles;
+  depth++;
+}
+
+/* after a call pushed its return address */
+static void prof_call(uint16_t target)
+{
+  int8_t i;
+  for (i = 0; i < numprofiled; i++)
+    if (profiled[i].addr == target)
+    {
+      prof_push(i);
+      return;
+    }
+}
+
+/* before RET or RETI (of ret cycles) pops a return address */
+static void prof_ret(uint8_t ret)
+{
+  uint16_t sp = rd16(SPL);
+  /* drop calls that never returned, like the stack reset at startup */
+  while (depth && callstack[depth-1].sp < sp)
+    depth--;
+  if (!depth || callstack[depth-1].sp != sp)
+    return;
+  depth--;
+  uint64_t n = cycles + ret - callstack[depth].start;
+  if (callstack[depth].fn == PROF_ISR)
+    isrcycles += n;
+  else
+  {
+    profile_t *p = &profiled[callstack[depth].fn];
+    n -= isrcycles - callstack[depth].isrstart;
+    p->calls++;
+    p->cycles += n;
+    if (n > p->maxcycles)
+      p->maxcycles = n;
+  }
+}
+
+/***** CPU *****/
+
+static void push(uint8_t v)
+{
+  uint16_t sp = rd16(SPL);
+  mem_write(sp, v);
+  sp--;
+  data[SPL] = sp;
+  data[SPH] = sp >> 8;
+}
+
+static uint8_t pop()
+{
+  uint16_t sp = rd16(SPL)+1;
+  data[SPL] = sp;
+  data[SPH] = sp >> 8;
+  return mem_read(sp);
+}
+
+static void push_pc(uint16_t addr)
+{
+  push(addr);
+  push(addr >> 8);
+}
+
+static uint16_t pop_pc()
+{
+  uint16_t hi = pop();
+  return hi << 8 | pop();
+}
+
+static void setflag(uint8_t bit, int val)
+{
+  if (val)
+    SREGBITS |= 1 << bit;
+  else
+    SREGBITS &= ~(1 << bit);
+}
+
+#define FLAG(bit) ((SREGBITS >> (bit)) & 1)
+#define B7(v)     (((v) >> 7) & 1)
+#define B3(v)     (((v) >> 3) & 1)
+
+static void flags_nzs(uint8_t r, int v)
+{
+  setflag(SV, v);
+  setflag(SN, B7(r));
+  setflag(SZ, r == 0);
+  setflag(SS, B7(r) ^ v);
+}
+
+static uint8_t do_add(uint8_t d, uint8_t r, int carry)
+{
+  uint8_t res = d + r + carry;
+  uint8_t c = (d & r) | (r & ~res) | (~res & d);  /* carry out of each bit */
+  uint8_t v = (d & r & ~res) | (~d & ~r & res);
+  setflag(SH, B3(c));
+  setflag(SC, B7(c));
+  flags_nzs(res, B7(v));
+  return res;
+}
+
+/* keepz: SBC, SBCI and CPC only clear Z */
+static uint8_t do_sub(uint8_t d, uint8_t r, int carry, int keepz)
+{
+  uint8_t res = d - r - carry;
+  uint8_t b = (~d & r) | (r & res) | (res & ~d);  /* borrow into each bit */
+  uint8_t v = (d & ~r & ~res) | (~d & r & res);
+  int z = FLAG(SZ);
+  setflag(SH, B3(b));
+  setflag(SC, B7(b));
+  flags_nzs(res, B7(v));
+  if (keepz)
+    setflag(SZ, res == 0 && z);
+  return res;
+}
+
+static uint8_t do_logic(uint8_t res)
+{
+  flags_nzs(res, 0);
+  return res;
+}
+
+/* shifts right; the new bit 7 is top */
+static uint8_t do_shift(uint8_t d, uint8_t top)
+{
+  uint8_t res = (d >> 1) | (top << 7);
+  int c = d & 1;
+  setflag(SC, c);
+  flags_nzs(res, B7(res) ^ c);
+  return res;
+}
+
+static void do_mul(int32_t product, int shift)
+{
+  uint16_t p = product;
+  setflag(SC, p >> 15);
+  if (shift)
+    p <<= 1;
+  setflag(SZ, p == 0);
+  R[0] = p;
+  R[1] = p >> 8;
+}
+
+/* LDS, STS, JMP and CALL take two words */
+static int two_words(uint16_t op)
+{
+  return (op & 0xFC0F) == 0x9000 || (op & 0xFE0C) == 0x940C;
+}
+
+/* skip the next instruction; returns the extra cycles */
+static uint8_t skip()
+{
+  uint8_t words = two_words(flash[pc]) ? 2 : 1;
+  pc += words;
+  return words;
+}
+
+static uint16_t reg_pair(uint8_t r)
+{
+  return R[r] | R[r+1] << 8;
+}
+
+static void set_pair(uint8_t r, uint16_t v)
+{
+  R[r] = v;
+  R[r+1] = v >> 8;
+}
+
+static void __attribute__((noreturn)) bad_opcode(uint16_t op)
+{
+  fprintf(stderr, "unknown opcode %04X at %04X\n", op, 2*(pc-1));
+  exit(1);
+}
+
+/* runs one instruction; returns its cycles */
+static uint8_t step()
+{
+  uint16_t op = flash[pc++];
+  uint8_t d = (op >> 4) & 0x1F;
+  uint8_t r = (op & 0x0F) | ((op >> 5) & 0x10);
+  uint8_t k = (op & 0x0F) | ((op >> 4) & 0xF0);
+  uint8_t dh = 16 + ((op >> 4) & 0x0F);
+
+  switch (op >> 12)
+  {
+    case 0x0:
+      switch ((op >> 10) & 3)
+      {
+        case 0:
+          if (op == 0) /* NOP */
+            return 1;
+          switch ((op >> 8) & 3)
+          {
+            case 1: /* MOVW */
+              R[2*((op >> 4) & 0xF)] = R[2*(op & 0xF)];
+              R[2*((op >> 4) & 0xF)+1] = R[2*(op & 0xF)+1];
+              return 1;
+            case 2: /* MULS */
+              do_mul((int8_t)R[dh] * (int8_t)R[16 + (op & 0xF)], 0);
+              return 2;
+            case 3:
+            {
+              uint8_t a = 16 + ((op >> 4) & 7), b = 16 + (op & 7);
+              switch (op & 0x88)
+              {
+                case 0x00: do_mul((int8_t)R[a] * R[b], 0); break; /* MULSU */
+                case 0x08: do_mul(R[a] * R[b], 1); break;         /* FMUL */
+                case 0x80: do_mul((int8_t)R[a] * (int8_t)R[b], 1); break;
+                case 0x88: do_mul((int8_t)R[a] * R[b], 1); break;
+              }
+              return 2;
+            }
+          }
+          bad_opcode(op);
+        case 1: /* CPC */
+          do_sub(R[d], R[r], FLAG(SC), 1);
+          return 1;
+        case 2: /* SBC */
+          R[d] = do_sub(R[d], R[r], FLAG(SC), 1);
+          return 1;
+        case 3: /* ADD */
+          R[d] = do_add(R[d], R[r], 0);
+          return 1;
+      }
+    case 0x1:
+      switch ((op >> 10) & 3)
+      {
+        case 0: /* CPSE */
+          return (R[d] == R[r]) ? 1 + skip() : 1;
+        case 1: /* CP */
+          do_sub(R[d], R[r], 0, 0);
+          return 1;
+        case 2: /* SUB */
+          R[d] = do_sub(R[d], R[r], 0, 0);
+          return 1;
+        case 3: /* ADC */
+          R[d] = do_add(R[d], R[r], FLAG(SC));
+          return 1;
+      }
+    case 0x2:
+      switch ((op >> 10) & 3)
+      {
+        case 0: R[d] = do_logic(R[d] & R[r]); return 1;  /* AND */
+        case 1: R[d] = do_logic(R[d] ^ R[r]); return 1;  /* EOR */
+        case 2: R[d] = do_logic(R[d] | R[r]); return 1;  /* OR */
+        case 3: R[d] = R[r]; return 1;                   /* MOV */
+      }
+    case 0x3: /* CPI */
+      do_sub(R[dh], k, 0, 0);
+      return 1;
+    case 0x4: /* SBCI */
+      R[dh] = do_sub(R[dh], k, FLAG(SC), 1);
+      return 1;
+    case 0x5: /* SUBI */
+      R[dh] = do_sub(R[dh], k, 0, 0);
+      return 1;
+    case 0x6: /* ORI */
+      R[dh] = do_logic(R[dh] | k);
+      return 1;
+    case 0x7: /* ANDI */
+      R[dh] = do_logic(R[dh] & k);
+      return 1;
+    case 0x8:
+    case 0xA: /* LDD/STD with displacement */
+    {
+      uint8_t q = (op & 7) | ((op >> 7) & 0x18) | ((op >> 8) & 0x20);
+      uint16_t addr = reg_pair((op & 0x08) ? 28 : 30) + q;
+      if (op & 0x0200)
+        mem_write(addr, R[d]);
+      else
+        R[d] = mem_read(addr);
+      return 2;
+    }
+    case 0x9:
+      break; /* below */
+    case 0xB: /* IN, OUT */
+    {
+      uint8_t a = (op & 0x0F) | ((op >> 5) & 0x30);
+      if (op & 0x0800)
+        mem_write(a + 0x20, R[d]);
+      else
+        R[d] = mem_read(a + 0x20);
+      return 1;
+    }
+    case 0xC: /* RJMP */
+      pc += (int16_t)(op << 4) >> 4;
+      return 2;
+    case 0xD: /* RCALL */
+      push_pc(pc);
+      pc += (int16_t)(op << 4) >> 4;
+      prof_call(pc);
+      return 3;
+    case 0xE: /* LDI */
+      R[dh] = k;
+      return 1;
+    case 0xF:
+      if (!(op & 0x0800)) /* BRBS, BRBC */
+      {
+        int set = FLAG(op & 7);
+        if (set == !(op & 0x0400))
+        {
+          pc += (int16_t)(op << 6) >> 9;
+          return 2;
+        }
+        return 1;
+      }
+      switch ((op >> 9) & 3)
+      {
+        case 0: /* BLD */
+          if (FLAG(ST))
+            R[d] |= 1 << (op & 7);
+          else
+            R[d] &= ~(1 << (op & 7));
+          return 1;
+        case 1: /* BST */
+          setflag(ST, (R[d] >> (op & 7)) & 1);
+          return 1;
+        case 2: /* SBRC */
+          return (!((R[d] >> (op & 7)) & 1)) ? 1 + skip() : 1;
+        case 3: /* SBRS */
+          return ((R[d] >> (op & 7)) & 1) ? 1 + skip() : 1;
+      }
+  }
+
+  /* 0x9xxx */
+  if ((op & 0xFC00) == 0x9C00) /* MUL */
+  {
+    do_mul(R[d] * R[r], 0);
+    return 2;
+  }
+  if ((op & 0xFC00) == 0x9000) /* loads and stores */
+  {
+    int store = op & 0x0200;
+    uint16_t addr;
+    uint8_t ptr, cyc = 2;
+    switch (op & 0x0F)
+    {
+      case 0x0: /* LDS, STS */
+        addr = flash[pc++];
+        if (store)
+          mem_write(addr, R[d]);
+        else
+          R[d] = mem_read(addr);
+        return 2;
+      case 0x4: case 0x5: /* LPM Z, LPM Z+ */
+        if (store)
+          bad_opcode(op);
+        addr = reg_pair(30);
+        R[d] = ((const uint8_t *)flash)[addr & (FLASH_SIZE-1)];
+        if (op & 1)
+          set_pair(30, addr+1);
+        return 3;
+      case 0xF: /* POP, PUSH */
+        if (store)
+          push(R[d]);
+        else
+          R[d] = pop();
+        return 2;
+      case 0x1: case 0x2: ptr = 30; break;
+      case 0x9: case 0xA: ptr = 28; break;
+      case 0xC: case 0xD: case 0xE: ptr = 26; break;
+      default:
+        bad_opcode(op);
+    }
+    addr = reg_pair(ptr);
+    if ((op & 3) == 2) /* pre-decrement */
+      set_pair(ptr, --addr);
+    if (store)
+      mem_write(addr, R[d]);
+    else
+      R[d] = mem_read(addr);
+    if ((op & 3) == 1) /* post-increment */
+      set_pair(ptr, addr+1);
+    return cyc;
+  }
+  if ((op & 0xFE08) == 0x9400 && (op & 0x0F) != 0x04) /* one-operand ALU */
+  {
+    switch (op & 0x0F)
+    {
+      case 0x0: /* COM */
+        R[d] = do_logic(~R[d]);
+        setflag(SC, 1);
+        return 1;
+      case 0x1: /* NEG */
+      {
+        uint8_t res = -R[d];
+        setflag(SH, B3(res) | B3(R[d]));
+        setflag(SC, res != 0);
+        flags_nzs(res, res == 0x80);
+        R[d] = res;
+        return 1;
+      }
+      case 0x2: /* SWAP */
+        R[d] = (R[d] << 4) | (R[d] >> 4);
+        return 1;
+      case 0x3: /* INC */
+        R[d]++;
+        flags_nzs(R[d], R[d] == 0x80);
+        return 1;
+      case 0x5: /* ASR */
+        R[d] = do_shift(R[d], B7(R[d]));
+        return 1;
+      case 0x6: /* LSR */
+        R[d] = do_shift(R[d], 0);
+        return 1;
+      case 0x7: /* ROR */
+        R[d] = do_shift(R[d], FLAG(SC));
+        return 1;
+    }
+  }
+  if ((op & 0xFE0F) == 0x940A) /* DEC */
+  {
+    R[d]--;
+    flags_nzs(R[d], R[d] == 0x7F);
+    return 1;
+  }
+  if ((op & 0xFF0F) == 0x9408) /* BSET, BCLR */
+  {
+    uint8_t bit = (op >> 4) & 7;
+    setflag(bit, !(op & 0x80));
+    if (bit == SI && !(op & 0x80))
+      irqhold = 1; /* the instruction after SEI runs first */
+    return 1;
+  }
+  if ((op & 0xFE0C) == 0x940C) /* JMP, CALL */
+  {
+    uint16_t target = flash[pc++];
+    if (op & 0x0002)
+    {
+      push_pc(pc);
+      pc = target;
+      prof_call(pc);
+      return 4;
+    }
+    pc = target;
+    return 3;
+  }
+  switch (op)
+  {
+    case 0x9409: /* IJMP */
+      pc = reg_pair(30);
+      return 2;
+    case 0x9509: /* ICALL */
+      push_pc(pc);
+      pc = reg_pair(30);
+      prof_call(pc);
+      return 3;
+    case 0x9508: /* RET */
+      prof_ret(4);
+      pc = pop_pc();
+      return 4;
+    case 0x9518: /* RETI */
+      prof_ret(4);
+      pc = pop_pc();
+      setflag(SI, 1);
+      irqhold = 1;
+      return 4;
+    case 0x9588: /* SLEEP */
+      sleeping = 1;
+      return 1;
+    case 0x9598: /* BREAK */
+    case 0x95A8: /* WDR */
+    case 0x95E8: /* SPM */
+      return 1;
+    case 0x95C8: /* LPM */
+      R[0] = ((const uint8_t *)flash)[reg_pair(30) & (FLASH_SIZE-1)];
+      return 3;
+  }
+  if ((op & 0xFE00) == 0x9600) /* ADIW, SBIW */
+  {
+    uint8_t rp = 24 + 2*((op >> 4) & 3);
+    uint8_t kk = (op & 0x0F) | ((op >> 2) & 0x30);
+    uint16_t v = reg_pair(rp), res;
+    int hi = B7(R[rp+1]);
+    if (op & 0x0100)
+    {
+      res = v - kk;
+      setflag(SC, (res >> 15) & (1^hi));
+      setflag(SV, hi & (1^(res >> 15)));
+    }
+    else
+    {
+      res = v + kk;
+      setflag(SC, (1^(res >> 15)) & hi);
+      setflag(SV, (1^hi) & (res >> 15));
+    }
+    setflag(SN, res >> 15);
+    setflag(SZ, res == 0);
+    setflag(SS, FLAG(SN) ^ FLAG(SV));
+    set_pair(rp, res);
+    return 2;
+  }
+  if ((op & 0xFC00) == 0x9800) /* CBI, SBIC, SBI, SBIS */
+  {
+    uint8_t a = 0x20 + ((op >> 3) & 0x1F), bit = 1 << (op & 7);
+    switch ((op >> 8) & 3)
+    {
+      case 0: /* CBI */
+        if (a != TIFR0 && a != TIFR1)
+          mem_write(a, mem_read(a) & ~bit);
+        return 2;
+      case 1: /* SBIC */
+        return (!(mem_read(a) & bit)) ? 1 + skip() : 1;
+      case 2: /* SBI; on flag registers only the addressed bit is written */
+        mem_write(a, (a == TIFR0 || a == TIFR1) ? bit : mem_read(a) | bit);
+        return 2;
+      case 3: /* SBIS */
+        return (mem_read(a) & bit) ? 1 + skip() : 1;
+    }
+  }
+  bad_opcode(op);
+  return 0;
+}
+
+/* takes a pending interrupt; returns its cycles */
+static uint8_t interrupt()
+{
+  uint8_t vec = 0;
+  if (!FLAG(SI) || irqhold)
+    return 0;
+
+  if ((data[TIMSK1] & 0x02) && (data[TIFR1] & 0x02))
+  {
+    vec = VEC_TIMER1_COMPA;
+    data[TIFR1] &= ~0x02;
+  }
+  else if ((data[TIMSK0] & 0x02) && (data[TIFR0] & 0x02))
+  {
+    vec = VEC_TIMER0_COMPA;
+    data[TIFR0] &= ~0x02;
+  }
+  else if ((data[SPCR] & 0x80) && (data[SPSR] & 0x80))
+  {
+    vec = VEC_SPI_STC;
+    data[SPSR] &= ~0x80;
+  }
+  else if ((data[UCSR0B] & 0x80) && rxcount)
+    vec = VEC_USART_RX;
+  else if (data[UCSR0B] & 0x20)
+    vec = VEC_USART_UDRE;
+  else if ((data[EECR] & 0x08) && !eedone)
+    vec = VEC_EE_READY;
+  if (!vec)
+    return 0;
+
+  sleeping = 0;
+  push_pc(pc);
+  prof_push(PROF_ISR);
+  setflag(SI, 0);
+  pc = 2*vec;
+  return 4;
+}
+
+/***** Loading *****/
+
+static uint32_t le32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+/* loads the ELF file's segments into flash by their load addresses */
+static void load_elf(const char *name)
+{
+  FILE *f = fopen(name, "rb");
+  static uint8_t buf[256*1024];
+  size_t len;
+  uint32_t phoff;
+  uint16_t phnum, phentsize, i;
+
+  if (!f)
+  {
+    perror(name);
+    exit(1);
+  }
+  len = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+  if (len < 52 || memcmp(buf, "\x7F" "ELF\x01\x01", 6))
+  {
+    fprintf(stderr, "%s: not a 32-bit little-endian ELF file\n", name);
+    exit(1);
+  }
+  phoff = le32(buf+28);
+  phentsize = le16(buf+42);
+  phnum = le16(buf+44);
+  memset(flash, 0xFF, sizeof(flash));
+  for (i = 0; i < phnum; i++)
+  {
+    const uint8_t *ph = buf + phoff + i*phentsize;
+    if (phoff + (i+1)*phentsize > len)
+      break;
+    uint32_t type = le32(ph), off = le32(ph+4), paddr = le32(ph+12);
+    uint32_t filesz = le32(ph+16);
+    if (type != 1 || !filesz || paddr >= FLASH_SIZE) /* PT_LOAD in flash */
+      continue;
+    if (off + filesz > len || paddr + filesz > FLASH_SIZE)
+    {
+      fprintf(stderr, "%s: segment out of range\n", name);
+      exit(1);
+    }
+    memcpy((uint8_t *)flash + paddr, buf + off, filesz);
+  }
+
+  /* look up the profiled functions in the symbol table */
+  uint32_t shoff = le32(buf+32);
+  uint16_t shentsize = le16(buf+46), shnum = le16(buf+48);
+  for (i = 0; i < shnum && shoff + (i+1)*shentsize <= len; i++)
+  {
+    const uint8_t *sh = buf + shoff + i*shentsize;
+    if (le32(sh+4) != 2) /* SHT_SYMTAB */
+      continue;
+    const uint8_t *strsh = buf + shoff + le32(sh+24)*shentsize;
+    uint32_t off = le32(sh+16), size = le32(sh+20);
+    uint32_t stroff = le32(strsh+16), strsize = le32(strsh+20), j;
+    if (off + size > len || stroff + strsize > len)
+      break;
+    for (j = 0; j + 16 <= size; j += 16)
+    {
+      const uint8_t *sym = buf + off + j;
+      uint32_t name = le32(sym);
+      int k;
+      if ((sym[12] & 0xF) != 2 || name >= strsize) /* STT_FUNC */
+        continue;
+      for (k = 0; k < numprofiled; k++)
+        if (!strncmp(profiled[k].name, (const char *)buf + stroff + name,
+                     strsize - name))
+          profiled[k].addr = le32(sym+4)/2;
+    }
+  }
+}
+
+static void __attribute__((noreturn)) usage(const char *prog)
+{
+  fprintf(stderr,
+    "usage: %s [-b baud] [-f frames] [-i input] [-s start] [-o prefix]\n"
+    "          [-e every] [-t txfile] [-p func,...] main.elf\n"
+    "  -b  baud rate the input arrives at (38400)\n"
+    "  -f  frames to run (120)\n"
+    "  -i  file of bytes to send to the receiver\n"
+    "  -s  frame to start sending at, after the firmware has set up (30)\n"
+    "  -o  write frames to <prefix>NNNN.pgm\n"
+    "  -e  write only every n-th frame\n"
+    "  -t  write what the firmware transmits to a file\n"
+    "  -p  report the cycles per call of these functions\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long baud = 38400, maxframes = 120, startframe = 30;
+  uint8_t *input = NULL;
+  size_t inputlen = 0, inputpos = 0;
+  uint64_t nextrx = 0, rxcycles, maxcycles;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:f:i:s:o:e:t:p:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': baud = strtoul(optarg, NULL, 10); break;
+      case 'f': maxframes = strtoul(optarg, NULL, 10); break;
+      case 's': startframe = strtoul(optarg, NULL, 10); break;
+      case 'o': outprefix = optarg; break;
+      case 'e': outevery = strtoul(optarg, NULL, 10); break;
+      case 'i':
+      {
+        FILE *f = fopen(optarg, "rb");
+        if (!f)
+        {
+          perror(optarg);
+          return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        inputlen = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        input = malloc(inputlen+1);
+        inputlen = fread(input, 1, inputlen, f);
+        fclose(f);
+        break;
+      }
+      case 't':
+        if (!(txfile = fopen(optarg, "wb")))
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'p':
+      {
+        char *name;
+        for (name = strtok(optarg, ","); name && numprofiled < MAX_PROFILED;
+             name = strtok(NULL, ","))
+        {
+          profiled[numprofiled].name = name;
+          profiled[numprofiled++].addr = -1;
+        }
+        break;
+      }
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (optind != argc-1 || !baud || !outevery)
+    usage(argv[0]);
+
+  load_elf(argv[optind]);
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  data[SPL] = (DATA_SIZE-1) & 0xFF;
+  data[SPH] = (DATA_SIZE-1) >> 8;
+  data[UCSR0A] = 0x20; /* UDRE0 */
+  data[PIND] = 0xFF;   /* pulled up */
+  rxcycles = 10ULL*F_CPU/baud;
+  /* give up if the frame timer stops */
+  maxcycles = (maxframes+10) * (uint64_t)F_CPU/MIN_REFRESH_HZ;
+
+  while (frames < maxframes && cycles < maxcycles)
+  {
+    uint8_t n = interrupt();
+    if (!n)
+    {
+      if (irqhold)
+        irqhold--;
+      n = (sleeping) ? 1 : step();
+      if (!n)
+        bad_opcode(flash[pc-1]);
+    }
+    tick(n);
+
+    if (input && frames >= startframe && inputpos < inputlen &&
+        cycles >= nextrx)
+    {
+      if (!nextrx)
+      {
+        unsigned long set = usart_baud();
+        if (set*100 < baud*97 || set*100 > baud*103)
+          fprintf(stderr, "warning: the USART is set to %lu baud, not %lu\n",
+                  set, baud);
+      }
+      else
+        rx_byte(input[inputpos++]);
+      nextrx = cycles + rxcycles;
+    }
+  }
+
+  if (frames < maxframes)
+    fprintf(stderr, "the frame timer stopped after %lu frames\n", frames);
+  printf("%lu frames in %.3f s, %lu late (worst %llu cycles after the "
+         "timer), %lu skipped\n", frames, (double)cycles/F_CPU, lateframes,
+         (unsigned long long)worstlate, skippedframes);
+  printf("%lu of %zu bytes received at %lu baud, %lu lost to overruns; "
+         "%lu sent\n", rxbytes, inputlen, baud, rxdropped, txbytes);
+  if (outprefix)
+    printf("%lu frames written to %s*.pgm\n", written, outprefix);
+  if (numprofiled)
+    printf("function             calls  cycles/call    max\n");
+  for (opt = 0; opt < numprofiled; opt++)
+  {
+    profile_t *p = &profiled[opt];
+    if (p->addr < 0)
+      printf("%-18s  not in the ELF file (static and inlined?)\n", p->name);
+    else
+      printf("%-18s %7lu %12.1f %6llu\n", p->name, p->calls,
+             (p->calls) ? (double)p->cycles/p->calls : 0.0,
+             (unsigned long long)p->maxcycles);
+  }
+  if (txfile)
+    fclose(txfile);
+  return (rxdropped || lateframes || skippedframes) ? 2 : 0;
+}
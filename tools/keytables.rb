@@ -0,0 +1,102 @@
+#!/usr/bin/env ruby
+
+# Packs the scancode tables in keybuffer/keymap.h into keybuffer/keytables.h
+# for the lookup in keybuffer/keylookup.h.
+# The base table is copied as is. The shifted and extended tables become a
+# bitmap of the scancodes that don't follow the default rule, a running
+# count of set bits before each bitmap byte, and the values themselves.
+#   shifted:  letters become upper case, everything else is unchanged
+#   extended: 0
+# Result is written to stdout, and should be sent to keytables.h.
+# Example:
+#    ./keytables.rb ../keybuffer/keymap.h ../keybuffer/keycodes.h > ../keybuffer/keytables.h
+
+keymap, keycodes = ARGV
+if !keymap || !keycodes then
+  $stderr.puts "usage: #{$0} keymap.h keycodes.h"
+  exit 1
+end
+
+# names usable in the tables: K_* values and keymap.h's short aliases
+names = {}
+File.read(keycodes).scan(/^#define\s+(\w+)\s+(0x\h+|\d+)/) do |n, v|
+  names[n] = Integer(v)
+end
+File.read(keymap).scan(/^#define\s+(\w+)\s+(\w+)\s*$/) do |n, v|
+  names[n] = names[v] if names[v]
+end
+
+ESCAPES = { 'n' => 10, 't' => 9, 'b' => 8, 'r' => 13, '0' => 0,
+            '\\' => 92, '\'' => 39, '"' => 34 }
+
+def value(tok, names)
+  case tok
+  when /\A'\\(.)'\z/ then ESCAPES[$1] or raise "unknown escape #{tok}"
+  when /\A'(.)'\z/ then $1.ord
+  when /\A(0x\h+|\d+)\z/ then Integer(tok)
+  else names[tok] or raise "unknown name #{tok}"
+  end
+end
+
+src = File.read(keymap).gsub(%r{//.*$}, '')
+tables = {}
+src.scan(/char\s+(\w+)\[\]\s*PROGMEM\s*=\s*\{(.*?)\};/m) do |name, body|
+  toks = body.scan(/'\\.'|'[^']'|[^\s,]+/)
+  tables[name] = toks.map { |t| value(t, names) }
+end
+
+base = tables['codetable'] or raise "no codetable"
+shifted = tables['codetable_shifted'] or raise "no codetable_shifted"
+ext = tables['codetable_extended'] or raise "no codetable_extended"
+if shifted.length != base.length || ext.length != base.length then
+  raise "tables differ in length"
+end
+
+def upcase(c)
+  (c >= 'a'.ord && c <= 'z'.ord) ? c - 32 : c
+end
+
+def c_bytes(vals)
+  vals.each_slice(16).map { |s| '  ' + s.map { |v| '0x%02X' % v }.join(', ') }.join(",\n")
+end
+
+# bitmap, ranks and values for the entries where table differs from default
+def sparse(table, &default)
+  bits = Array.new((table.length + 7) / 8, 0)
+  vals = []
+  table.each_with_index do |v, code|
+    if v != default.call(code) then
+      bits[code >> 3] |= 1 << (code & 7)
+      vals << v
+    end
+  end
+  rank = []
+  bits.inject(0) { |n, b| rank << n; n + b.to_s(2).count('1') }
+  raise "too many entries" if vals.length >= 255
+  [bits, rank, vals]
+end
+
+shift = sparse(shifted) { |code| upcase(base[code]) }
+extd = sparse(ext) { |code| 0 }
+
+total = base.length + [shift, extd].map { |t| t.map(&:length).sum }.sum
+puts "/* Generated by tools/keytables.rb from keymap.h. Do not edit. */"
+puts "/* #{total} bytes; the unpacked tables are #{3*base.length} bytes */"
+puts
+puts "#define KEY_MAX_CODE 0x%02X" % (base.length - 1)
+puts
+puts "static const uint8_t key_base[#{base.length}] PROGMEM = {"
+puts c_bytes(base)
+puts "};"
+[['shift', shift], ['ext', extd]].each do |name, (bits, rank, vals)|
+  puts
+  puts "static const uint8_t key_#{name}_bits[#{bits.length}] PROGMEM = {"
+  puts c_bytes(bits)
+  puts "};"
+  puts "static const uint8_t key_#{name}_rank[#{rank.length}] PROGMEM = {"
+  puts c_bytes(rank)
+  puts "};"
+  puts "static const uint8_t key_#{name}_vals[#{vals.length}] PROGMEM = {"
+  puts c_bytes(vals)
+  puts "};"
+end
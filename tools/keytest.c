@@ -0,0 +1,56 @@
+/* Packed scancode table check
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Looks up every scancode with every shift/ctrl/extended combination in the
+ * packed tables (keybuffer/keytables.h, via keylookup.h) and in the plain
+ * tables they were generated from (keybuffer/keymap.h), and reports any
+ * difference. Built and run on the host by "make keytest" in keybuffer/.
+ */
+
+#include <stdio.h>
+#include "../keybuffer/keylookup.h"
+#include "../keybuffer/keymap.h"
+
+/* how decode() picked a keycode from the plain tables */
+static uint8_t plain_lookup(uint8_t code, uint8_t mods, uint8_t extended)
+{
+  if (extended)
+    return codetable_extended[code];
+  else if (mods & 0b1100) // ctrl
+    return codetable[code] & 31;
+  else if (mods & 0b0011) // shift
+    return codetable_shifted[code];
+  else
+    return codetable[code];
+}
+
+int main()
+{
+  unsigned code, mods, extended, checked = 0, failed = 0;
+
+  if (sizeof(codetable) != KEY_MAX_CODE+1)
+  {
+    printf("keytables.h is out of date; run \"make keytables.h\"\n");
+    return 1;
+  }
+
+  for (code = 0; code <= KEY_MAX_CODE; code++)
+    for (mods = 0; mods < 16; mods++)
+      for (extended = 0; extended < 2; extended++)
+      {
+        uint8_t want = plain_lookup(code, mods, extended);
+        uint8_t got = key_lookup(code, mods, extended);
+        checked++;
+        if (got != want)
+        {
+          if (failed++ < 10)
+            printf("scancode %02X mods %X%s: got %02X, want %02X\n",
+                   code, mods, (extended) ? " extended" : "", got, want);
+        }
+      }
+
+  printf("%u lookups, %u wrong\n", checked, failed);
+  return (failed) ? 1 : 0;
+}
@@ -0,0 +1,459 @@
+/* Keyboard link test
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Runs the keyboard buffer (keybuffer/main.c) and the terminal's keyboard
+ * reader (kb_start_read(), its timer interrupt and poll_keyboard() in
+ * main.c) against each other on the host, on one simulated clock. The
+ * interrupts on both sides run at the times they would, with a random
+ * latency for the buffer's USI interrupt up to the -l option; each frame
+ * starts a read after the video and handles it at a random point in the
+ * main loop. Keys are typed, held and queued in bursts, and errors are
+ * counted, and the test checks that every key arrives once and in order,
+ * that held keys repeat at the rate the terminal sets, arrow keys in
+ * batches if it asks for them, that a lost scancode doesn't leave a key
+ * repeating, that the error counters are sent only when they change, and
+ * that no read is still going when the next frame starts: a keyboard frame
+ * longer than KB_PASS_BYTES takes more than one.
+ * Built and run by "make linktest".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <avr/io.h>
+
+/* port B, which both sides use (host/avr/io.h declares it), and the
+ * keyboard buffer's other ATtiny45 registers */
+volatile uint8_t DDRB, PORTB, PINB;
+volatile uint8_t GIMSK, PCMSK, USIDR, USISR, USICR;
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B, TCNT0, TIFR, TIMSK;
+#define PCIE    5
+#define PCINT4  4
+#define USIOIF  6
+#define USIOIE  6
+#define USIWM0  4
+#define USICS1  3
+#define WGM01   1
+#define CS02    2
+#define CS00    0
+#define OCIE0A  4
+#define OCIE0B  3
+#define OCF0B   3
+
+#define main      tiny_main
+#define spi_init  tiny_spi_init
+#define kberrors  tiny_kberrors
+#include "../keybuffer/main.c"
+#undef main
+#undef spi_init
+#undef kberrors
+
+/* the terminal's SPI registers. Reading SPSR with SPIF set, then SPDR,
+ * reads the byte received and clears SPIF, as on the chip; any other
+ * access to SPDR is a write, which starts a transfer. See spdr_access()
+ * and spsr_read(). */
+volatile uint8_t SPCR;
+#define SPE   6
+#define MSTR  4
+#define SPR0  0
+#define SPIF  7
+static volatile uint8_t *spdr_access(void);
+static uint8_t spsr_read(void);
+#define SPDR  (*spdr_access())
+#define SPSR  (spsr_read())
+
+/* and its timer 0, apart from the buffer's */
+volatile uint8_t term_TCCR0A, term_TCCR0B, term_OCR0A, term_TCNT0;
+volatile uint8_t TIMSK0, TIFR0;
+#define TCCR0A  term_TCCR0A
+#define TCCR0B  term_TCCR0B
+#define OCR0A   term_OCR0A
+#define TCNT0   term_TCNT0
+#define CS01    1
+#define OCF0A   1
+
+#define main              terminal_main
+#define TIMER0_COMPA_vect kb_read_vect
+#include "../main.c"
+#undef main
+#undef TIMER0_COMPA_vect
+
+/* simulated time, in microseconds */
+#define TICK_US       (1024.0*(TICK_OCR+1)/8)  /* the buffer's timer0 tick */
+#define SPI_BYTE_US   (128.0/(F_CPU/1000000))  /* 8 bits at F_CPU/16 */
+#define KB_BYTE_US    ((double)KB_BYTE_CYCLES/(F_CPU/1000000))
+#define FRAME_US      ((FRAME_TOP+1)*1024.0/(F_CPU/1000000))
+#define VIDEO_US      ((double)LINE_CYCLES*NUM_LINES/(F_CPU/1000000))
+static double now;
+static double nexttick;
+static double usidue;         /* when the USI interrupt runs; 0 if idle */
+static double xferdue;        /* when the SPI transfer ends; 0 if idle */
+static double readdue;        /* the terminal's next timer 0 interrupt */
+static double maxlatency = 30;
+
+/* SPI transfer state */
+static uint8_t spiout;        /* written by the terminal */
+static uint8_t spiin;         /* received by the terminal */
+static uint8_t spishift;      /* what it's receiving */
+static uint8_t spif, spsrread;
+
+/* read statistics */
+static int errorframes, collisions, passes, maxpasses;
+
+static void spi_done(void)
+{
+  /* the buffer's interrupt loads its next byte after a latency; what the
+   * terminal shifted out is left in USIDR meanwhile */
+  spiin = spishift;
+  USIDR = spiout;
+  if (!usidue)
+    usidue = now + 1 + (rand() % (int)maxlatency);
+  spif = 1;
+}
+
+static void read_interrupt(void)
+{
+  kb_read_vect();
+  if (kbpos == 1 && (kbframe[0] & KB_COUNT_ERRORS))
+    errorframes++;
+  readdue = (TIMSK0 & _BV(OCIE0A)) ? readdue + KB_BYTE_US : 0;
+}
+
+/* runs the interrupts on both sides that are due by time t, in order */
+static void run_until(double t)
+{
+  for (;;)
+  {
+    double next = nexttick;
+    if (usidue && usidue < next)
+      next = usidue;
+    if (xferdue && xferdue < next)
+      next = xferdue;
+    if (readdue && readdue < next)
+      next = readdue;
+    if (next > t)
+      break;
+    now = next;
+    if (next == xferdue)
+    {
+      xferdue = 0;
+      spi_done();
+    }
+    else if (next == usidue)
+    {
+      usidue = 0;
+      USI_OVF_vect();
+    }
+    else if (next == readdue)
+      read_interrupt();
+    else
+    {
+      nexttick += TICK_US;
+      TIMER0_COMPA_vect();
+    }
+  }
+  now = t;
+}
+
+void host_delay_us(double us)
+{
+  run_until(now + us);
+}
+
+static volatile uint8_t *spdr_access(void)
+{
+  if (spsrread)
+  {
+    spsrread = spif = 0;
+    return &spiin;
+  }
+  /* the terminal shifts in what the buffer has loaded */
+  if (xferdue)
+    collisions++;
+  spishift = USIDR;
+  xferdue = now + SPI_BYTE_US;
+  return &spiout;
+}
+
+static uint8_t spsr_read(void)
+{
+  spsrread = spif;
+  return (spif) ? _BV(SPIF) : 0;
+}
+
+/* the keys the terminal gets, in order */
+#define MAX_KEYS 2000
+static uint8_t got[MAX_KEYS];
+static int numgot;
+static int numruns;           /* app_handle_keys() calls with count > 1 */
+
+void app_handle_keys(uint8_t key, uint8_t count)
+{
+  if (count > 1)
+    numruns++;
+  while (count--)
+    if (numgot < MAX_KEYS)
+      got[numgot++] = key;
+}
+
+/* the rest of what main.c calls */
+void video_setup() { }
+void video_start() { }
+void video_wait() { }
+void video_output_frame() { }
+void video_puts(char *s) { (void)s; }
+void app_setup() { }
+uint8_t app_main_loop() { return 0; }
+
+static int polls, latereads, failed;
+
+/* the next frame: a pass of the read starts after the video, and the main
+ * loop handles the keyboard frame if it has finished by the time the loop
+ * does */
+static void frame_poll()
+{
+  double start = polls*FRAME_US;
+  if (start > now)
+    run_until(start);
+  if (readdue)                /* it would interrupt the video */
+    latereads++;
+  run_until(now + VIDEO_US);
+  kb_start_read();
+  if (TIMSK0 & _BV(OCIE0A))
+  {
+    readdue = now + KB_BYTE_US;
+    passes = (kbpos) ? passes + 1 : 1;
+    if (passes > maxpasses)
+      maxpasses = passes;
+  }
+  run_until(now + rand() % (int)(FRAME_US - VIDEO_US));
+  poll_keyboard();
+  polls++;
+}
+
+static void run_frames(int n)
+{
+  while (n--)
+    frame_poll();
+}
+
+static void reset()
+{
+  now = 0;
+  nexttick = TICK_US;
+  usidue = xferdue = readdue = 0;
+  spif = spsrread = 0;
+  kbpos = kblen = kbresync = kbnumkeys = kbsettings = TIMSK0 = 0;
+  numgot = numruns = polls = errorframes = 0;
+  memset(kberrors, 0, sizeof(kberrors));
+  kb_init();
+  tiny_spi_init();
+  cmdpending = 0;             /* no keyboard to talk to */
+}
+
+static void check(int ok, const char *test, const char *what)
+{
+  if (!ok)
+  {
+    printf("%s: %s\n", test, what);
+    failed++;
+  }
+}
+
+static void check_keys(const char *test, const uint8_t *want, int numwant)
+{
+  int i;
+  if (numgot != numwant)
+  {
+    printf("%s: got %d keys, want %d\n", test, numgot, numwant);
+    failed++;
+    return;
+  }
+  for (i = 0; i < numwant; i++)
+    if (got[i] != want[i])
+    {
+      printf("%s: key %d is %02X, want %02X\n", test, i, got[i], want[i]);
+      failed++;
+      return;
+    }
+}
+
+/* keys at random times, a few per frame at most, including control
+ * characters that look like status bytes and counts */
+static void test_typing()
+{
+  static uint8_t want[500];
+  int i;
+  reset();
+  for (i = 0; i < 500; i++)
+  {
+    double t = now + rand() % 20000;
+    while (polls*FRAME_US <= t)
+      frame_poll();
+    if (t > now)
+      run_until(t);
+    buffer_put_key(want[i] = 1 + rand() % 0x9A);
+  }
+  run_frames(10);
+  check_keys("typing", want, 500);
+  check(!overflowed && !(kbstatus & KB_STAT_OVERFLOW), "typing", "overflow");
+  check(errorframes == 0, "typing", "error counters sent without errors");
+}
+
+/* a burst bigger than a frame is spread over several reads, each over
+ * as many passes as it takes; the first full one carries the error
+ * counters too, which is the longest read */
+static void test_burst()
+{
+  static uint8_t want[MAX_BUF];
+  int i;
+  reset();
+  run_frames(3);
+  count_error(KB_ERR_PARITY);
+  for (i = 0; i < MAX_BUF; i++)
+    buffer_put_key(want[i] = 'A' + i % 26);
+  run_frames((MAX_BUF + KB_FRAME_MAX - 1)/KB_FRAME_MAX*
+             ((KB_FRAME_BYTES + KB_PASS_BYTES - 1)/KB_PASS_BYTES) + 2);
+  check_keys("burst", want, MAX_BUF);
+  check(errorframes == 1, "burst", "error counters not sent once");
+}
+
+/* each change to the error counters is sent once, with or without keys */
+static void test_errors()
+{
+  static uint8_t want[20];
+  int i;
+  reset();
+  for (i = 0; i < 20; i++)
+  {
+    count_error(i % KB_NUM_ERRORS);
+    if (i % 2)
+      buffer_put_key(want[i/2] = 'a' + i);
+    run_frames(3);
+  }
+  run_frames(3);              /* the last may take more than one pass */
+  check_keys("errors", want, 10);
+  check(errorframes == 20, "errors", "error counters not sent once each");
+  check(!memcmp(kberrors, tiny_kberrors, KB_NUM_ERRORS), "errors",
+        "error counters differ");
+}
+
+/* a held key repeats, and every repeat arrives; until the terminal sends
+ * settings, at the buffer's own rate */
+static void test_repeat()
+{
+  int i, frames = 120;
+  reset();
+  decode(0x1C);               /* 'a' down */
+  run_frames(frames);
+  decode(0xF0);               /* and up */
+  decode(0x1C);
+  run_frames(5);
+  int want = 1 + (int)((frames*FRAME_US/TICK_US - REPEAT_DELAY_TICKS) /
+                       REPEAT_RATE_TICKS) + 1;
+  check(numgot >= want - 1 && numgot <= want, "repeat", "wrong repeat count");
+  for (i = 0; i < numgot; i++)
+    check(got[i] == 'a', "repeat", "wrong key");
+  check(numruns == 0, "repeat", "repeats of a letter came together");
+}
+
+/* set to repeat at 15 keys/s in batches, a held arrow key repeats at that
+ * rate, but in batches that arrive in one frame each */
+static void test_arrow_repeat()
+{
+  int i, frames = 120, rate = 8*KB_SET_RATE_TICKS;
+  reset();
+  kbsettings = KB_SET_MARK | 8 | KB_SET_BATCH;
+  decode(0xE0);               /* up arrow down */
+  decode(0x75);
+  run_frames(frames);
+  decode(0xE0);               /* and up */
+  decode(0xF0);
+  decode(0x75);
+  run_frames(5);
+  check(repeatrate == rate && arrowbatch == KB_FRAME_MAX, "arrow repeat",
+        "settings not received");
+  int batches = (int)((frames*FRAME_US/TICK_US - REPEAT_DELAY_TICKS) /
+                      (rate*KB_FRAME_MAX));
+  int want = 2 + batches*KB_FRAME_MAX;
+  check(numgot >= want - KB_FRAME_MAX && numgot <= want,
+        "arrow repeat", "wrong repeat count");
+  for (i = 0; i < numgot; i++)
+    check(got[i] == K_UP, "arrow repeat", "wrong key");
+  check(numruns >= batches - 1, "arrow repeat", "batches were split");
+}
+
+/* with repeat turned off, a held key is typed once */
+static void test_repeat_off()
+{
+  reset();
+  kbsettings = KB_SET_MARK;
+  decode(0x1C);               /* 'a' down */
+  run_frames(120);
+  decode(0xF0);               /* and up */
+  decode(0x1C);
+  run_frames(5);
+  check_keys("repeat off", (const uint8_t *)"a", 1);
+}
+
+/* a lost F0 leaves the key's break code looking like a typematic make
+ * code; the key must stop repeating and not be typed again */
+static void test_lost_release()
+{
+  reset();
+  decode(0x1C);               /* 'a' down */
+  run_frames(10);
+  scancode_lost(KB_ERR_PARITY); /* its F0 */
+  decode(0x1C);
+  run_frames(60);
+  check_keys("lost release", (const uint8_t *)"a", 1);
+  decode(0x1C);               /* pressed again */
+  decode(0xF0);
+  decode(0x1C);
+  run_frames(5);
+  check_keys("lost release", (const uint8_t *)"aa", 2);
+
+  /* or the break code itself was lost */
+  reset();
+  decode(0x1C);
+  decode(0xF0);
+  scancode_lost(KB_ERR_FRAMING);
+  run_frames(60);
+  check_keys("lost break code", (const uint8_t *)"a", 1);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "l:")) != -1)
+  {
+    if (opt == 'l')
+      maxlatency = atof(optarg);
+    else
+    {
+      fprintf(stderr, "usage: %s [-l max interrupt latency in us]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (maxlatency < 1)
+    maxlatency = 1;
+
+  srand(1);
+  test_typing();
+  test_burst();
+  test_errors();
+  test_repeat();
+  test_arrow_repeat();
+  test_repeat_off();
+  test_lost_release();
+
+  printf("%d bytes per pass (KB_PASS_BYTES), longest read %d passes\n",
+         KB_PASS_BYTES, maxpasses);
+  check(collisions == 0, "read", "SPDR written during a transfer");
+  check(latereads == 0, "read", "not finished before the next frame");
+  printf("%s\n", (failed) ? "FAILED" : "ok");
+  return (failed) ? 1 : 0;
+}
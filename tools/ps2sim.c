@@ -0,0 +1,176 @@
+/* PS/2 bitstream simulator
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Feeds clean and corrupted PS/2 frames through the keyboard buffer's
+ * frame receiver (keybuffer/ps2rx.h) the same way its clock interrupt and
+ * timer tick do, and checks which scancodes come out and which errors are
+ * counted. Built and run on the host by "make ps2sim" in keybuffer/.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../keybuffer/ps2rx.h"
+
+/* from keybuffer/main.c: 2 ms ticks, 2 ticks without an edge abandons a
+ * frame. edges are 80 us apart. */
+#define TICK_US           2048
+#define PS2_TIMEOUT_TICKS 2
+#define BIT_US            80
+#define FRAME_GAP_US      2000  /* between bytes of one key */
+#define KEY_GAP_US        20000 /* between keys */
+
+#define MAX_BITS  400
+#define MAX_CODES 16
+
+enum { ERR_PARITY, ERR_FRAMING, ERR_TIMEOUT, NUM_ERRORS };
+
+/* one falling edge: when, and the data line */
+typedef struct
+{
+  unsigned long t;
+  unsigned char bit;
+} edge_t;
+
+static edge_t edges[MAX_BITS];
+static int numedges;
+static unsigned long now;
+
+static void gap(unsigned long us)
+{
+  now += us;
+}
+
+static void edge(unsigned char bit)
+{
+  edges[numedges].t = now;
+  edges[numedges].bit = bit;
+  numedges++;
+  now += BIT_US;
+}
+
+/* corruptions applied to one frame */
+#define BAD_START   1
+#define BAD_PARITY  2
+#define BAD_STOP    4
+#define EXTRA_EDGE  8   /* glitch on the clock line */
+#define LOST_EDGE   16  /* a data bit is never clocked */
+#define STRAY_EDGE  32  /* glitch on the clock line while idle */
+
+static void frame(unsigned char code, int bad)
+{
+  int i, ones = 0;
+  if (bad & STRAY_EDGE)
+  {
+    edge(1);
+    gap(KEY_GAP_US);
+  }
+  edge((bad & BAD_START) ? 1 : 0);
+  for (i = 0; i < 8; i++)
+  {
+    unsigned char bit = (code >> i) & 1;
+    ones += bit;
+    if (i == 3 && (bad & LOST_EDGE))
+      continue;
+    edge(bit);
+    if (i == 3 && (bad & EXTRA_EDGE))
+      edge(bit);
+  }
+  edge(((ones & 1) ? 0 : 1) ^ ((bad & BAD_PARITY) ? 1 : 0));
+  edge((bad & BAD_STOP) ? 0 : 1);
+}
+
+/* run the edges through the receiver, interleaving timer ticks the way the
+ * interrupts would */
+static int run(unsigned char *codes, unsigned *errors)
+{
+  ps2rx_t rx;
+  unsigned long tick = TICK_US;
+  int i, numcodes = 0;
+  unsigned char quiet = 0;
+
+  ps2rx_reset(&rx);
+  memset(errors, 0, NUM_ERRORS*sizeof(*errors));
+  for (i = 0; i <= numedges; i++)
+  {
+    unsigned long t = (i < numedges) ? edges[i].t
+                                     : now + 2*TICK_US*PS2_TIMEOUT_TICKS;
+    for (; tick <= t; tick += TICK_US)
+    {
+      if (ps2rx_busy(&rx) && ++quiet >= PS2_TIMEOUT_TICKS)
+      {
+        ps2rx_reset(&rx);
+        errors[ERR_TIMEOUT]++;
+      }
+    }
+    if (i == numedges)
+      break;
+
+    quiet = 0;
+    switch (ps2rx_bit(&rx, edges[i].bit))
+    {
+      case PS2RX_DONE:
+        if (numcodes < MAX_CODES)
+          codes[numcodes++] = rx.scancode;
+        break;
+      case PS2RX_PARITY:
+        errors[ERR_PARITY]++;
+        break;
+      case PS2RX_START:
+      case PS2RX_STOP:
+        errors[ERR_FRAMING]++;
+        break;
+    }
+  }
+  return numcodes;
+}
+
+/* sends "A down, A up, right arrow down, S down", corrupting the byte at
+ * badpos, and checks what was received. A corrupted byte can take the
+ * rest of its key with it, but the next key must always get through. */
+static int check(const char *name, int badpos, int bad,
+                 const char *expect, unsigned parity, unsigned framing,
+                 unsigned timeout)
+{
+  static const unsigned char seq[] = { 0x1C, 0xF0, 0x1C, 0xE0, 0x74, 0x1B };
+  unsigned char codes[MAX_CODES];
+  unsigned errors[NUM_ERRORS];
+  char got[3*MAX_CODES+1] = "";
+  int i, n, ok;
+
+  numedges = 0;
+  now = 0;
+  for (i = 0; i < (int)sizeof(seq); i++)
+  {
+    frame(seq[i], (i == badpos) ? bad : 0);
+    gap((i == 2 || i == 4) ? KEY_GAP_US : FRAME_GAP_US);
+  }
+
+  n = run(codes, errors);
+  for (i = 0; i < n; i++)
+    sprintf(got+strlen(got), "%s%02X", (i) ? " " : "", codes[i]);
+
+  ok = !strcmp(got, expect) && errors[ERR_PARITY] == parity &&
+       errors[ERR_FRAMING] == framing && errors[ERR_TIMEOUT] == timeout;
+  printf("%-4s %-18s %-18s parity %u, framing %u, timeout %u\n",
+         (ok) ? "ok" : "FAIL", name, got,
+         errors[ERR_PARITY], errors[ERR_FRAMING], errors[ERR_TIMEOUT]);
+  if (!ok)
+    printf("     expected %-18s    parity %u, framing %u, timeout %u\n",
+           expect, parity, framing, timeout);
+  return ok;
+}
+
+int main()
+{
+  int ok = 1;
+  ok &= check("clean",            -1, 0,          "1C F0 1C E0 74 1B", 0, 0, 0);
+  ok &= check("bad parity",        1, BAD_PARITY, "1C 1C E0 74 1B",    1, 0, 0);
+  ok &= check("bad stop bit",      0, BAD_STOP,   "F0 1C E0 74 1B",    0, 1, 0);
+  ok &= check("bad start bit",     3, BAD_START,  "1C F0 1C 1B",       0, 2, 1);
+  ok &= check("extra clock edge",  4, EXTRA_EDGE, "1C F0 1C E0 1B",    1, 1, 0);
+  ok &= check("lost clock edge",   2, LOST_EDGE,  "1C F0 E0 74 1B",    0, 0, 1);
+  ok &= check("stray clock edge",  3, STRAY_EDGE, "1C F0 1C E0 74 1B", 0, 1, 0);
+  return (ok) ? 0 : 1;
+}
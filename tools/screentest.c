@@ -0,0 +1,240 @@
+/* Escape sequence conformance test
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Runs each case in tools/screens/ through the host build of the terminal
+ * and compares the screen with the one recorded in the case. Built and run
+ * on the host by "make screentest"; "make screentest UPDATE=1" rewrites the
+ * recorded screens with what the terminal does now, to be checked by eye.
+ *
+ * A case is a text file:
+ *   # comments
+ *   in: bytes to send, with \e, \r, \n, \t, \b, \xNN and \\ escapes
+ *   in: (more bytes; in: lines are joined without anything in between)
+ *   screen:
+ *   |one line per row, starting with |, trailing spaces dropped
+ *   attr:
+ *   |a row of flags per row: r reverse video, g box drawing character
+ *   |(shown in the screen rows as the character that selects it), R both
+ *   cursor: row column
+ * The attr: block is left out if there are no flags. Characters above 0x7F
+ * (with FONT=6x8x256) are shown as "?", like DEL. The terminal is
+ * reset with ESC c before each case. Rows and columns are numbered from 1,
+ * like CUP; column TILES_WIDE+1 means a wrap is pending.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../host/host.h"
+#include "../video.h"
+
+extern uint8_t showcursor;
+extern char *cursorcell;
+
+#define MAX_INPUT 4096
+#define MAX_TEXT  8192
+
+static int parse_input(const char *s, uint8_t *out, size_t *len)
+{
+  while (*s && *s != '\n')
+  {
+    uint8_t c = *s++;
+    if (c == '\\')
+    {
+      switch (*s++)
+      {
+        case 'e': c = 0x1B; break;
+        case 'r': c = '\r'; break;
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'b': c = '\b'; break;
+        case '\\': c = '\\'; break;
+        case 'x':
+        {
+          unsigned v;
+          if (sscanf(s, "%2x", &v) != 1)
+            return 0;
+          c = v;
+          s += 2;
+          break;
+        }
+        default:
+          return 0;
+      }
+    }
+    if (*len >= MAX_INPUT)
+      return 0;
+    out[(*len)++] = c;
+  }
+  return 1;
+}
+
+/* the screen, without the cursor, in the case file format */
+static void snapshot(char *text)
+{
+  static char attrs[TILES_HIGH][TILES_WIDE+1];
+  char *p = text;
+  int x, y, anyattr = 0;
+#ifdef FONT_6x8_FULL
+  int cursoroff = (showcursor) ? cursorcell - (char *)&ATTRMAP[0][0][0] : -1;
+#else
+  int cursoroff = (showcursor) ? cursorcell - &TILEMAP[0][0] : -1;
+#endif
+
+  p += sprintf(p, "screen:\n");
+  for (y = 0; y < TILES_HIGH; y++)
+  {
+    char row[TILES_WIDE+1];
+    int end = 0;
+    for (x = 0; x < TILES_WIDE; x++)
+    {
+      uint8_t c = TILEMAP[y][x];
+      uint8_t rev, ch, attr;
+#ifdef FONT_6x8_FULL
+      /* the 256-glyph font: reverse video and the cursor are in ATTRMAP */
+      uint8_t a = ATTRMAP[y][x/8][0];
+      if ((char *)&ATTRMAP[y][x/8][0]-(char *)&ATTRMAP[0][0][0] == cursoroff)
+        a ^= showcursor;
+      rev = a & (0x80 >> (x%8));
+      ch = (c & 0x80) ? 0x7F : c;
+#else
+      if (y*TILES_WIDE+x == cursoroff)
+        c ^= showcursor;
+      rev = c & 0x80;
+      ch = c & 0x7F;
+#endif
+      attr = (rev) ? 'r' : ' ';
+      if (ch == 0)
+        ch = ' ';
+      else if (ch < ' ')
+      {
+        ch += 95; /* see receive_char() */
+        attr = (rev) ? 'R' : 'g';
+      }
+      else if (ch == 0x7F)
+        ch = '?';
+      row[x] = ch;
+      attrs[y][x] = attr;
+      if (ch != ' ')
+        end = x+1;
+      if (attr != ' ')
+        anyattr = 1;
+    }
+    row[end] = '\0';
+    p += sprintf(p, "|%s\n", row);
+  }
+
+  if (anyattr)
+  {
+    p += sprintf(p, "attr:\n");
+    for (y = 0; y < TILES_HIGH; y++)
+    {
+      int end = TILES_WIDE;
+      while (end && attrs[y][end-1] == ' ')
+        end--;
+      attrs[y][end] = '\0';
+      p += sprintf(p, "|%s\n", attrs[y]);
+    }
+  }
+  sprintf(p, "cursor: %d %d\n", video_gety()+1, video_getx()+1);
+}
+
+/* prints the rows that differ */
+static void show_diff(const char *expect, const char *got)
+{
+  while (*expect || *got)
+  {
+    size_t el = strcspn(expect, "\n"), gl = strcspn(got, "\n");
+    if (el != gl || strncmp(expect, got, el))
+    {
+      printf("  expected %.*s\n", (int)el, expect);
+      printf("       got %.*s\n", (int)gl, got);
+    }
+    expect += el + (expect[el] == '\n');
+    got += gl + (got[gl] == '\n');
+  }
+}
+
+static int run_case(const char *name, int update)
+{
+  static char file[MAX_TEXT], got[MAX_TEXT];
+  static uint8_t input[MAX_INPUT];
+  size_t len = 0, inputlen = 0;
+  char *expect, *line;
+  FILE *f = fopen(name, "r");
+
+  if (!f)
+  {
+    perror(name);
+    return 0;
+  }
+  len = fread(file, 1, sizeof(file)-1, f);
+  fclose(f);
+  file[len] = '\0';
+
+  for (line = file; *line; line += strcspn(line, "\n") + 1)
+  {
+    if (!strncmp(line, "in: ", 4) && !parse_input(line+4, input, &inputlen))
+    {
+      printf("FAIL %s: bad input line\n", name);
+      return 0;
+    }
+    if (!strncmp(line, "screen:", 7) || !line[strcspn(line, "\n")])
+      break;
+  }
+  expect = line;
+
+  host_receive((const uint8_t *)"\x1B" "c", 2);
+  host_receive(input, inputlen);
+  snapshot(got);
+
+  if (update)
+  {
+    if (!(f = fopen(name, "w")))
+    {
+      perror(name);
+      return 0;
+    }
+    fwrite(file, 1, expect-file, f);
+    fputs(got, f);
+    fclose(f);
+    return 1;
+  }
+  if (strcmp(expect, got))
+  {
+    printf("FAIL %s\n", name);
+    show_diff(expect, got);
+    return 0;
+  }
+  printf("ok   %s\n", name);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  int i, update = 0, passed = 0, cases = 0;
+
+  if (TILES_WIDE != 54 || TILES_HIGH != 24)
+  {
+    printf("the cases are recorded at 54x24, not %dx%d\n", TILES_WIDE,
+           TILES_HIGH);
+    return 1;
+  }
+
+  host_setup();
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-u"))
+    {
+      update = 1;
+      continue;
+    }
+    cases++;
+    passed += run_case(argv[i], update);
+  }
+  if (!update)
+    printf("%d of %d cases passed\n", passed, cases);
+  return (passed == cases) ? 0 : 1;
+}
@@ -0,0 +1,349 @@
+/* Terminal throughput benchmark
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Replays generated workloads (dmesg, top, vim scrolling, ls -l and an
+ * ncurses menu) through the host build of the terminal the way the
+ * firmware sees them: each frame, the bytes that arrive at the baud rate
+ * go through buf_enqueue(), then app_main_loop() prints what it can. It
+ * reports bytes per frame, receive buffer high-water marks and dropped
+ * bytes, which don't depend on the host, and how long frames and a few
+ * functions take on the host, which only mean something compared with
+ * another run on the same machine.
+ *
+ * The core is built with -finstrument-functions for this; function names
+ * are looked up with nm. Times are inclusive. Built and run by
+ * "make bench"; give a baud rate to use something other than 38400.
+ * "make sim" reports AVR cycles per call for the same functions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <stdint.h>
+#include "../host/host.h"
+
+extern void buf_enqueue(uint8_t c);
+extern uint8_t buf_size();
+extern uint8_t app_main_loop();
+extern void receive_char(uint8_t c);
+
+#define NOINST __attribute__((no_instrument_function))
+
+/***** Workloads *****/
+
+#define MAX_STREAM 65536
+
+static uint8_t stream[MAX_STREAM];
+static size_t streamlen;
+static uint32_t seed;
+
+static NOINST unsigned rnd(unsigned n)
+{
+  seed = seed*1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+static NOINST void out(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static NOINST void out(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf((char *)stream+streamlen, MAX_STREAM-streamlen, fmt, ap);
+  va_end(ap);
+  if (n > 0 && streamlen+n < MAX_STREAM)
+    streamlen += n;
+}
+
+static const char *words[] = {
+  "usb", "device", "new", "high-speed", "using", "ehci_hcd", "address",
+  "eth0", "link", "up", "mounted", "filesystem", "with", "ordered", "data",
+  "mode", "input:", "keyboard", "as", "ata1:", "SATA", "1.5", "Gbps"
+};
+#define NUM_WORDS (sizeof(words)/sizeof(*words))
+
+/* kernel log: long lines of plain text that wrap */
+static NOINST void gen_dmesg()
+{
+  int i, n;
+  for (i = 0; i < 400; i++)
+  {
+    out("[%5d.%06d]", i/10, rnd(1000000));
+    for (n = 4+rnd(10); n; n--)
+      out(" %s", words[rnd(NUM_WORDS)]);
+    out("\r\n");
+  }
+}
+
+/* full-screen refreshes with absolute positioning and erase to end of
+ * line, and a reverse video header */
+static NOINST void gen_top()
+{
+  int i, p;
+  for (i = 0; i < 30; i++)
+  {
+    out("\x1B[H");
+    out("top - 12:%02d:%02d up 3 days, load average: 0.%02d\x1B[K\r\n",
+        i/60, i%60, rnd(100));
+    out("Tasks: %d total, %d running\x1B[K\r\n", 90+rnd(10), 1+rnd(3));
+    out("Mem: %dk total, %dk used\x1B[K\r\n\x1B[K\r\n", 2048, 900+rnd(100));
+    out("\x1B[7m  PID USER  %%CPU %%MEM COMMAND              \x1B[m\x1B[K\r\n");
+    for (p = 0; p < 17; p++)
+      out("%5d root  %4.1f %4.1f %-12s\x1B[K\r\n", 100+rnd(30000),
+          rnd(1000)/10.0, rnd(1000)/10.0, words[rnd(NUM_WORDS)]);
+    out("\x1B[J");
+  }
+}
+
+/* scrolling inside margins, in both directions, with the status line
+ * redrawn around the cursor */
+static NOINST void gen_vim()
+{
+  int i, n;
+  out("\x1B[H\x1B[2J\x1B[1;23r");
+  for (i = 0; i < 300; i++)
+  {
+    if ((i/50) & 1) /* scroll back up */
+      out("\x1B[1;1H\x1BM");
+    else
+      out("\x1B[23;1H\n");
+    for (n = 2+rnd(8); n; n--)
+      out("%s ", words[rnd(NUM_WORDS)]);
+    out("\x1B" "7\x1B[24;1H\x1B[7m main.c  line %d of 900 \x1B[m\x1B[K\x1B" "8",
+        i);
+  }
+  out("\x1B[r");
+}
+
+/* directory listing: short lines, scrolling the whole screen */
+static NOINST void gen_ls()
+{
+  int i;
+  for (i = 0; i < 500; i++)
+    out("-rw-r--r-- 1 user group %6d Oct %2d 12:%02d file%03d.c\r\n",
+        rnd(100000), 1+rnd(31), rnd(60), i);
+}
+
+/* dialog box redrawn with box drawing characters as the selection moves */
+static NOINST void gen_menu()
+{
+  int i, item, x;
+  for (i = 0; i < 60; i++)
+  {
+    out("\x1B[5;10H\x0E" "l");
+    for (x = 0; x < 30; x++)
+      out("q");
+    out("k\x0F");
+    for (item = 0; item < 10; item++)
+    {
+      out("\x1B[%d;10H\x0Ex\x0F", 6+item);
+      if (item == i%10)
+        out("\x1B[7m");
+      out(" Menu item %-2d              \x1B[m ", item);
+      out("\x0Ex\x0F");
+    }
+    out("\x1B[16;10H\x0Em");
+    for (x = 0; x < 30; x++)
+      out("q");
+    out("j\x0F");
+  }
+}
+
+typedef struct
+{
+  const char *name;
+  void (*gen)();
+} workload_t;
+
+static const workload_t workloads[] = {
+  { "dmesg", gen_dmesg },
+  { "top",   gen_top },
+  { "vim",   gen_vim },
+  { "ls -l", gen_ls },
+  { "menu",  gen_menu }
+};
+#define NUM_WORKLOADS (sizeof(workloads)/sizeof(*workloads))
+
+/***** Function timing *****/
+
+static NOINST uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+typedef struct
+{
+  const char *name;
+  uintptr_t addr;
+  uint64_t start, ns;
+  unsigned long calls;
+} probe_t;
+
+static probe_t probes[] = {
+  { "receive_char" },
+  { "escseq_get_param" },
+  { "video_putc_raw" },
+  { "_video_scrollup" }
+};
+#define NUM_PROBES (sizeof(probes)/sizeof(*probes))
+
+static uint64_t timer_ns; /* cost of reading the clock, taken off each call */
+
+NOINST void __cyg_profile_func_enter(void *fn, void *site)
+{
+  unsigned i;
+  for (i = 0; i < NUM_PROBES; i++)
+    if ((uintptr_t)fn == probes[i].addr)
+    {
+      probes[i].calls++;
+      probes[i].start = now_ns();
+    }
+}
+
+NOINST void __cyg_profile_func_exit(void *fn, void *site)
+{
+  unsigned i;
+  for (i = 0; i < NUM_PROBES; i++)
+    if ((uintptr_t)fn == probes[i].addr)
+    {
+      uint64_t t = now_ns()-probes[i].start;
+      probes[i].ns += (t > timer_ns) ? t-timer_ns : 0;
+    }
+}
+
+/* find the probed functions; static ones aren't in the dynamic symbol
+ * table, so ask nm */
+static NOINST int find_probes(const char *exe)
+{
+  char cmd[512], line[256], name[200];
+  unsigned long long addr, mainaddr = 0;
+  unsigned i, found = 0;
+  char type;
+
+  snprintf(cmd, sizeof(cmd), "nm '%s'", exe);
+  FILE *f = popen(cmd, "r");
+  if (!f)
+    return 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "%llx %c %199s", &addr, &type, name) != 3)
+      continue;
+    if (!strcmp(name, "main"))
+      mainaddr = addr;
+    for (i = 0; i < NUM_PROBES; i++)
+      if (!strcmp(name, probes[i].name))
+        probes[i].addr = addr;
+  }
+  pclose(f);
+
+  /* the executable may have been loaded somewhere else */
+  extern int main(int argc, char **argv);
+  uintptr_t slide = (uintptr_t)main - mainaddr;
+  for (i = 0; i < NUM_PROBES; i++)
+    if (probes[i].addr)
+    {
+      probes[i].addr += slide;
+      found++;
+    }
+  return mainaddr && found == NUM_PROBES;
+}
+
+/***** Replay *****/
+
+static NOINST void run(const workload_t *w, unsigned perframe, uint8_t smooth)
+{
+  size_t pos = 0;
+  unsigned frames = 0, maxprinted = 0, highwater = 0, dropped = 0;
+  uint64_t total = 0, worst = 0;
+
+  seed = 1;
+  streamlen = 0;
+  w->gen();
+
+  host_setup();
+  if (smooth)
+    host_receive((const uint8_t *)"\x1B[?4h", 5);
+
+  while (pos < streamlen || buf_size())
+  {
+    unsigned n, before;
+    for (n = 0; n < perframe && pos < streamlen; n++)
+    {
+      before = buf_size();
+      buf_enqueue(stream[pos++]);
+      if (buf_size() == before)
+        dropped++;
+    }
+    before = buf_size();
+    if (before > highwater)
+      highwater = before;
+
+    uint64_t t = now_ns();
+    app_main_loop();
+    t = now_ns()-t;
+    frame++;
+
+    total += t;
+    if (t > worst)
+      worst = t;
+    if (before-buf_size() > maxprinted)
+      maxprinted = before-buf_size();
+    frames++;
+  }
+
+  printf("%-8s %6zu %6u %7.1f %6u %7u %7u %8.2f %8.2f\n",
+         w->name, streamlen, frames, (double)streamlen/frames, maxprinted,
+         highwater, dropped, total/1000.0/frames, worst/1000.0);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long baud = (argc > 1) ? strtoul(argv[1], NULL, 10) : 38400;
+  double refresh = (double)F_CPU/FRAME_PRESCALE/(FRAME_TOP+1);
+  unsigned perframe = baud/10/refresh + 0.5;
+  unsigned i, smooth;
+
+  if (!baud || !perframe)
+  {
+    fprintf(stderr, "usage: %s [baud]\n", argv[0]);
+    return 1;
+  }
+  if (!find_probes(argv[0]))
+  {
+    fprintf(stderr, "%s: can't find the probed functions with nm\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t t = now_ns();
+  for (i = 0; i < 1000; i++)
+    now_ns();
+  timer_ns = (now_ns()-t)/1000;
+
+  printf("%dx%d, %lu baud, %.1f Hz: %u bytes arrive per frame, "
+         "receive buffer %d bytes\n",
+         TILES_WIDE, TILES_HIGH, baud, refresh, perframe, RX_BUF_SIZE);
+
+  for (smooth = 0; smooth < 2; smooth++)
+  {
+    for (i = 0; i < NUM_PROBES; i++)
+      probes[i].calls = probes[i].ns = 0;
+
+    printf("\nsmooth scroll %s\n", (smooth) ? "on" : "off");
+    printf("workload  bytes frames B/frame  max B buf max dropped "
+           "frame us  max us\n");
+    for (i = 0; i < NUM_WORKLOADS; i++)
+      run(&workloads[i], perframe, smooth);
+
+    printf("\nfunction            calls   ns/call\n");
+    for (i = 0; i < NUM_PROBES; i++)
+      printf("%-16s %8lu %9.1f\n", probes[i].name, probes[i].calls,
+             (probes[i].calls) ? (double)probes[i].ns/probes[i].calls : 0.0);
+  }
+  return 0;
+}
@@ -0,0 +1,424 @@
+/* Escape sequence fuzzer
+ * Matt Sarnoff (www.msarnoff.org)
+ * Released under the "do whatever you want with it, but let me know if you've
+ * used it for something awesome and give me credit" license.
+ *
+ * Feeds arbitrary bytes through receive_char() in the host build of the
+ * terminal, built with AddressSanitizer, and after every byte checks that
+ * the cursor is on the screen and inside the margins, that the cursor cell
+ * is a visible cell, and that the spare row of TILEMAP is only written
+ * while a smooth scroll is in progress. Writes outside TILEMAP and the
+ * other arrays are caught by AddressSanitizer. On the AVR all of these
+ * silently corrupt whatever is next in RAM.
+ *
+ * LLVMFuzzerTestOneInput() runs one input, so the file links with
+ * libFuzzer:
+ *   clang -fsanitize=fuzzer,address -DLIBFUZZER <$(HOSTCOMPILE) flags>
+ *     tools/termfuzz.c video.c termconfig.c terminal.c latency.c perf.c
+ *     host/shim.c
+ * Without -DLIBFUZZER there is a small coverage-guided driver of its own,
+ * for compilers with -fsanitize-coverage=trace-pc but no libFuzzer (gcc):
+ *   termfuzz [-r runs] [-s seed] [-o dir] [file...]
+ * It runs each file first, then mutates them (and a few built-in seeds)
+ * for the given number of runs, keeping inputs that reach new code. The
+ * first failing input is shrunk to the fewest bytes that fail the same
+ * way and written to dir. Built and run by "make fuzz", which replays the
+ * regression inputs in tools/fuzz/; add minimised failures there once
+ * they are fixed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../host/host.h"
+#include "../video.h"
+
+extern void receive_char(uint8_t c);
+extern uint8_t showcursor;
+extern char *cursorcell;
+extern uint8_t scrolloffset;
+
+static const char *failure; /* what went wrong in this run */
+
+static void fail(const char *what)
+{
+  if (!failure)
+    failure = what;
+#ifdef LIBFUZZER
+  fprintf(stderr, "termfuzz: %s\n", what);
+  abort();
+#endif
+}
+
+/* AddressSanitizer calls this before reporting an error; with
+ * -fsanitize-recover=address and halt_on_error=0 the program goes on.
+ * Every error is reported, not just the first at each place, so each
+ * input that fails is seen to. */
+void __asan_on_error()
+{
+  fail("memory error (see the AddressSanitizer report)");
+}
+
+const char *__asan_default_options()
+{
+  return "halt_on_error=0:suppress_equal_pcs=0:detect_leaks=0";
+}
+
+static void check()
+{
+  int8_t x = video_getx(), y = video_gety();
+#ifdef FONT_6x8_FULL
+  char *first = (char *)&ATTRMAP[video_scrolling()][0][0];
+  int cells = sizeof(ATTRMAP[0])*TILES_HIGH;
+#else
+  char *first = &TILEMAP[video_scrolling()][0];
+  int cells = TILES_WIDE*TILES_HIGH;
+#endif
+
+  if (x < 0 || x > TILES_WIDE || y < 0 || y >= TILES_HIGH)
+    fail("cursor off the screen");
+  else if (video_top_margin() < 0 || video_bottom_margin() >= TILES_HIGH ||
+           video_top_margin() >= video_bottom_margin())
+    fail("bad margins");
+  else if (showcursor &&
+           (cursorcell < first || cursorcell >= first+cells))
+    fail("cursor cell not on the screen");
+  else if (scrolloffset >= TILE_HEIGHT)
+    fail("scroll offset past a row");
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static char spare[TILES_WIDE];
+  size_t i;
+
+  host_setup();
+  for (i = 0; i < size && !failure; i++)
+  {
+    uint8_t scrolling = video_scrolling();
+    memcpy(spare, TILEMAP[TILES_HIGH], TILES_WIDE);
+    receive_char(data[i]);
+    if (!scrolling && !video_scrolling() &&
+        memcmp(spare, TILEMAP[TILES_HIGH], TILES_WIDE))
+      fail("spare row written without scrolling");
+    check();
+    video_scroll_step(); /* as if a frame went by after every byte */
+  }
+  return 0;
+}
+
+#ifndef LIBFUZZER
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#define MAX_INPUT   1024
+#define MAX_CORPUS  4096
+#define MAP_SIZE    65536
+
+/***** Coverage *****/
+
+static uint8_t hits[MAP_SIZE]; /* blocks reached in this run */
+static uint8_t seen[MAP_SIZE]; /* blocks reached in any run */
+
+/* called at every basic block in the code built with
+ * -fsanitize-coverage=trace-pc */
+void __sanitizer_cov_trace_pc()
+{
+  uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+  hits[(pc ^ pc >> 16) & (MAP_SIZE-1)] = 1;
+}
+
+/* run an input; returns the failure, if any, and whether it reached code
+ * no other run has */
+static const char *run(const uint8_t *data, size_t len, int *newcode)
+{
+  unsigned i;
+  memset(hits, 0, sizeof(hits));
+  failure = NULL;
+  LLVMFuzzerTestOneInput(data, len);
+  if (newcode)
+  {
+    *newcode = 0;
+    for (i = 0; i < MAP_SIZE; i++)
+      if (hits[i] && !seen[i])
+      {
+        seen[i] = 1;
+        *newcode = 1;
+      }
+  }
+  return failure;
+}
+
+/***** Inputs *****/
+
+typedef struct
+{
+  uint8_t *data;
+  size_t len;
+} testcase_t;
+
+static testcase_t corpus[MAX_CORPUS];
+static unsigned corpussize;
+static uint32_t seed = 1;
+
+static unsigned rnd(unsigned n)
+{
+  seed = seed*1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+static void add_case(const uint8_t *data, size_t len)
+{
+  if (corpussize >= MAX_CORPUS)
+    return;
+  corpus[corpussize].data = malloc(len ? len : 1);
+  memcpy(corpus[corpussize].data, data, len);
+  corpus[corpussize].len = len;
+  corpussize++;
+}
+
+static int read_file(const char *name, uint8_t *buf, size_t *len)
+{
+  FILE *f = fopen(name, "rb");
+  if (!f)
+  {
+    perror(name);
+    return 0;
+  }
+  *len = fread(buf, 1, MAX_INPUT, f);
+  fclose(f);
+  return 1;
+}
+
+static void write_file(const char *name, const uint8_t *data, size_t len)
+{
+  FILE *f = fopen(name, "wb");
+  if (!f)
+  {
+    perror(name);
+    return;
+  }
+  fwrite(data, 1, len, f);
+  fclose(f);
+}
+
+/* print an input the way the screen test cases write them */
+static void print_input(const uint8_t *data, size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    if (data[i] == 0x1B)
+      printf("\\e");
+    else if (data[i] == '\\')
+      printf("\\\\");
+    else if (data[i] >= ' ' && data[i] < 0x7F)
+      putchar(data[i]);
+    else
+      printf("\\x%02x", data[i]);
+  }
+  putchar('\n');
+}
+
+/***** Mutation *****/
+
+/* pieces of escape sequences, so mutations reach the parser's states */
+static const char *tokens[] = {
+  "\x1B", "\x1B[", "\x1B[?", "\x1BP", "\x1B\\", ";", "0", "1", "9", "24",
+  "54", "99", "127", "128", "200", "255", "256", "300", "65535", "A", "B",
+  "C", "D", "E", "F", "G", "H", "J", "K", "f", "h", "l", "m", "n", "p", "r",
+  "q", "{", "~", "?", "-", "\x0E", "\x0F", "\x18", "\r", "\n", "\b", "\x1B" "7",
+  "\x1B" "8", "\x1B" "D", "\x1B" "E", "\x1B" "M", "\x1B" "c", "\x1B[?4h",
+  "\x1B[1;1H", "\x1B[24;54H", "\x1B[?92h", "\x1B[?92l"
+};
+#define NUM_TOKENS (sizeof(tokens)/sizeof(*tokens))
+
+static const char *seeds[] = {
+  "\x1B[5;10Hhello\x1B[2J",
+  "\x1B[3;20r\x1B[20;1H\n\n\x1BM\x1B[r",
+  "\x1B" "7\x1B[7m\x0Elqk\x0F\x1B" "8\x1B[K\x1B[1J",
+  "\x1B[?4h\x1B[24;1H\n\n\n\x1B[?4l",
+  "\x1BP1;1;1;0;0;2;0;0{ @??~~~~/~~??~~@\x1B\\",
+  "0123456789012345678901234567890123456789012345678901234567890"
+};
+#define NUM_SEEDS (sizeof(seeds)/sizeof(*seeds))
+
+static size_t mutate(uint8_t *buf, size_t len)
+{
+  unsigned n, i, count = 1+rnd(4);
+  while (count--)
+  {
+    size_t pos = (len) ? rnd(len+1) : 0;
+    switch (rnd(6))
+    {
+      case 0: /* change a byte */
+        if (len)
+          buf[rnd(len)] = rnd(256);
+        break;
+      case 1: /* insert a byte */
+        if (len < MAX_INPUT)
+        {
+          memmove(buf+pos+1, buf+pos, len-pos);
+          buf[pos] = (rnd(2)) ? rnd(256) : 0x20+rnd(0x60);
+          len++;
+        }
+        break;
+      case 2: /* insert a token */
+      {
+        const char *t = tokens[rnd(NUM_TOKENS)];
+        n = strlen(t);
+        if (len+n <= MAX_INPUT)
+        {
+          memmove(buf+pos+n, buf+pos, len-pos);
+          memcpy(buf+pos, t, n);
+          len += n;
+        }
+        break;
+      }
+      case 3: /* delete some bytes */
+        if (pos < len)
+        {
+          n = 1+rnd(len-pos < 8 ? len-pos : 8);
+          memmove(buf+pos, buf+pos+n, len-pos-n);
+          len -= n;
+        }
+        break;
+      case 4: /* repeat some bytes */
+        if (pos < len)
+        {
+          n = 1+rnd(len-pos < 16 ? len-pos : 16);
+          for (i = 1+rnd(8); i && len+n <= MAX_INPUT; i--)
+          {
+            memmove(buf+pos+n, buf+pos, len-pos);
+            len += n;
+          }
+        }
+        break;
+      case 5: /* splice in part of another input */
+      {
+        testcase_t *t = &corpus[rnd(corpussize)];
+        if (t->len)
+        {
+          unsigned from = rnd(t->len);
+          n = 1+rnd(t->len-from);
+          if (len+n <= MAX_INPUT)
+          {
+            memmove(buf+pos+n, buf+pos, len-pos);
+            memcpy(buf+pos, t->data+from, n);
+            len += n;
+          }
+        }
+        break;
+      }
+    }
+  }
+  return len;
+}
+
+/* remove pieces, largest first, while it still fails the same way; the
+ * AddressSanitizer reports of the attempts go to /dev/null */
+static size_t minimise(uint8_t *buf, size_t len, const char *how)
+{
+  static uint8_t tmp[MAX_INPUT];
+  size_t chunk, pos;
+  int err = dup(2), null = open("/dev/null", O_WRONLY);
+  dup2(null, 2);
+  close(null);
+  for (chunk = len/2; chunk; chunk /= 2)
+    for (pos = 0; pos+chunk <= len; )
+    {
+      memcpy(tmp, buf, pos);
+      memcpy(tmp+pos, buf+pos+chunk, len-pos-chunk);
+      if (run(tmp, len-chunk, NULL) == how)
+      {
+        len -= chunk;
+        memcpy(buf, tmp, len);
+      }
+      else
+        pos++;
+    }
+  dup2(err, 2);
+  close(err);
+  return len;
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t buf[MAX_INPUT];
+  unsigned long runs = 0, r;
+  const char *outdir = ".";
+  size_t len;
+  int opt, newcode, failed = 0;
+  unsigned i;
+
+  while ((opt = getopt(argc, argv, "r:s:o:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'r': runs = strtoul(optarg, NULL, 10); break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      case 'o': outdir = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-r runs] [-s seed] [-o dir] [file...]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  /* regression inputs first */
+  for (i = optind; i < argc; i++)
+  {
+    const char *how;
+    if (!read_file(argv[i], buf, &len))
+      return 1;
+    if ((how = run(buf, len, &newcode)))
+    {
+      printf("FAIL %s: %s\n", argv[i], how);
+      failed = 1;
+    }
+    add_case(buf, len);
+  }
+  if (failed)
+    return 1;
+  if (argc > optind)
+    printf("%d inputs passed\n", argc-optind);
+
+  for (i = 0; i < NUM_SEEDS; i++)
+  {
+    run((const uint8_t *)seeds[i], strlen(seeds[i]), &newcode);
+    add_case((const uint8_t *)seeds[i], strlen(seeds[i]));
+  }
+
+  for (r = 0; r < runs; r++)
+  {
+    const char *how;
+    testcase_t *t = &corpus[rnd(corpussize)];
+    memcpy(buf, t->data, t->len);
+    len = mutate(buf, t->len);
+
+    if ((how = run(buf, len, &newcode)))
+    {
+      char name[256];
+      size_t full = len;
+      len = minimise(buf, len, how);
+      run(buf, len, NULL); /* for the report */
+      snprintf(name, sizeof(name), "%s/crash-%lu", outdir, r);
+      write_file(name, buf, len);
+      printf("run %lu: %s\n%zu bytes, shrunk from %zu, written to %s:\n",
+             r, how, len, full, name);
+      print_input(buf, len);
+      return 1;
+    }
+    if (newcode)
+      add_case(buf, len);
+    if ((r+1) % 100000 == 0)
+      printf("%lu runs, %u inputs\n", r+1, corpussize);
+  }
+  if (runs)
+    printf("%lu runs, %u inputs, no failures\n", runs, corpussize);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,393 @@
+#!/usr/bin/env ruby
+
+# Cycle-counts video_output_frame from the preprocessed video-asm.S.
+# The renderer's timing is otherwise only written down as comments; this
+# walks the code the way the CPU does and reports
+#   - the spacing between pixel OUTs (flagged if it isn't PIXEL_CYCLES)
+#   - active video, horizontal blanking and scanline lengths, checking
+#     the scanline against LINE_CYCLES (and so LINE_OVERHEAD) in defs.h
+#   - frame length and what is left of the frame timer period
+# Conditional skips and branches on unknown data are followed both ways.
+# Both ways must rejoin, and they are reported if their cycle counts
+# differ; that's an error if it happens while pixels are going out.
+#
+# Input is video-asm.S run through the C preprocessor, followed by these
+# lines, so the preprocessor expands the values from defs.h:
+#    pixel_cycles = PIXEL_CYCLES
+#    line_cycles = LINE_CYCLES
+#    hsync_pin = HSYNC_PIN
+#    vsync_pin = VSYNC_PIN
+#    frame_cycles = <frame timer period>
+# The Makefile's "timing" target does this for each TILE_WIDTH. Exits
+# nonzero if pixel spacing is uneven, a scanline isn't LINE_CYCLES or the
+# frame doesn't fit.
+#
+# Example:
+#    avr-gcc -E -x assembler-with-cpp ... - < input | ./vtiming.rb
+
+# cycles for instructions that take the same time every time
+CYCLES = Hash.new(1).merge(
+  'mul' => 2, 'muls' => 2, 'mulsu' => 2, 'fmul' => 2,
+  'adiw' => 2, 'sbiw' => 2, 'ld' => 2, 'ldd' => 2, 'st' => 2, 'std' => 2,
+  'lds' => 2, 'sts' => 2, 'lpm' => 3, 'push' => 2, 'pop' => 2,
+  'rjmp' => 2, 'ijmp' => 2, 'jmp' => 3, 'rcall' => 3, 'icall' => 3,
+  'call' => 4, 'ret' => 4, 'reti' => 4, 'sbi' => 2, 'cbi' => 2)
+TWO_WORD = %w(lds sts jmp call)
+BRANCHES = {
+  'breq' => [:z, true],  'brne' => [:z, false],
+  'brcs' => [:c, true],  'brlo' => [:c, true],
+  'brcc' => [:c, false], 'brsh' => [:c, false] }
+SKIPS = %w(sbrc sbrs cpse sbic sbis)
+REGNAMES = { 'XL' => 26, 'XH' => 27, 'YL' => 28, 'YH' => 29,
+             'ZL' => 30, 'ZH' => 31 }
+
+Insn = Struct.new(:op, :args, :line)
+State = Struct.new(:regs, :z, :c, :cycles, :events)
+
+def fail_with(msg)
+  $stderr.puts "vtiming: #{msg}"
+  exit 2
+end
+
+# --- read and expand the source ---
+
+syms = {}
+def evaluate(expr, syms)
+  e = expr.gsub(/\b([A-Za-z_]\w*)\b/) do |name|
+    syms.key?(name) ? syms[name].to_s : name
+  end
+  e = e.gsub(/\b(0x[0-9a-fA-F]+|\d+)[lLuU]*\b/) { $1 }
+  return nil unless e =~ /\A[\s\d+\-*\/%()<>&|^~xa-fA-F]*\z/
+  Integer(eval(e)) rescue nil
+end
+
+lines = []
+$stdin.each_line do |l|
+  next if l.start_with?('#')
+  l = l.sub(/;.*/, '').strip
+  lines << l unless l.empty?
+end
+
+macros = {}
+body = []
+i = 0
+while i < lines.length
+  l = lines[i]
+  if l =~ /\A\.macro\s+(\w+)\s*(.*)\z/
+    name, params = $1, $2.split(/[\s,]+/).reject(&:empty?)
+    mbody = []
+    i += 1
+    while lines[i] != '.endm'
+      mbody << lines[i]
+      i += 1
+    end
+    macros[name] = [params, mbody]
+  else
+    body << l
+  end
+  i += 1
+end
+
+def expand(src, macros, syms, out)
+  i = 0
+  while i < src.length
+    l = src[i]
+    if l =~ /\A(\w+)\s*=\s*(.+)\z/ ||
+       l =~ /\A\.(?:set|equ)\s+(\w+)\s*,\s*(.+)\z/
+      v = evaluate($2, syms)
+      syms[$1] = v if v
+    elsif l =~ /\A\.(rept|irp)\s+(.+)\z/
+      kind, arg = $1, $2
+      depth, j = 1, i + 1
+      while depth > 0
+        depth += 1 if src[j] =~ /\A\.(rept|irp)\b/
+        depth -= 1 if src[j] == '.endr'
+        j += 1
+      end
+      if kind == 'rept'
+        count = evaluate(arg, syms) or fail_with("can't evaluate #{l}")
+        count.times { expand(src[i+1...j-1], macros, syms, out) }
+      else
+        name, *vals = arg.split(/\s*,\s*/)
+        vals.each do |v|
+          expand(src[i+1...j-1].map { |m| m.gsub("\\#{name}", v) },
+                 macros, syms, out)
+        end
+      end
+      i = j
+      next
+    elsif l =~ /\A(\w+)\s*(.*)\z/ && macros.key?($1)
+      params, mbody = macros[$1]
+      args = $2.split(/\s*,\s*/)
+      sub = mbody.map do |m|
+        params.each_with_index.inject(m) do |s, (p, k)|
+          s.gsub("\\#{p}", args[k].to_s)
+        end
+      end
+      expand(sub, macros, syms, out)
+    else
+      out << l
+    end
+    i += 1
+  end
+end
+
+flat = []
+expand(body, macros, syms, flat)
+
+# --- assemble the function into an instruction list with labels ---
+
+insns = []
+labels = Hash.new { |h, k| h[k] = [] }
+in_text = false
+started = false
+flat.each do |l|
+  in_text = true if l == '.text'
+  in_text = false if l == '.data' || l.start_with?('.section')
+  next unless in_text
+  while l =~ /\A([\w.]+):\s*(.*)\z/
+    started ||= ($1 == 'video_output_frame')
+    labels[$1] << insns.length if started
+    l = $2
+  end
+  next if l.empty? || l.start_with?('.') || !started
+  op, rest = l.split(/\s+/, 2)
+  insns << Insn.new(op.downcase, rest.to_s.split(/\s*,\s*/), l)
+end
+fail_with('video_output_frame not found') unless started
+
+%w(pixel_cycles line_cycles hsync_pin vsync_pin frame_cycles).each do |s|
+  fail_with("#{s} not given") unless syms.key?(s)
+end
+
+def target(insns, labels, from, name)
+  if name =~ /\A(\d+)([fb])\z/
+    defs = labels[$1]
+    t = ($2 == 'f') ? defs.find { |d| d > from }
+                    : defs.reverse.find { |d| d <= from }
+  else
+    t = labels[name].first
+  end
+  t or fail_with("no label #{name} for #{insns[from].line}")
+end
+
+# --- simulate ---
+
+def reg(name, syms)
+  return REGNAMES[name] if REGNAMES.key?(name)
+  return $1.to_i if name =~ /\Ar(\d+)\z/
+  syms[name]
+end
+
+def setz(st, v)
+  st.z = v.nil? ? nil : (v & 0xFF) == 0
+end
+
+$forks = []
+
+def step(insns, labels, syms, pc, st)
+  ins = insns[pc]
+  a = ins.args
+  r = lambda { |k| reg(a[k], syms) }
+  v = lambda { |k| (n = r.call(k)) && st.regs[n] }
+  imm = lambda { |k| evaluate(a[k], syms) }
+  unless SKIPS.include?(ins.op) || BRANCHES.key?(ins.op)
+    st.cycles += CYCLES[ins.op]
+  end
+
+  case ins.op
+  when 'ldi'
+    st.regs[r.call(0)] = imm.call(1) && imm.call(1) & 0xFF
+  when 'clr'
+    st.regs[r.call(0)] = 0; st.z = true; st.c = nil
+  when 'mov'
+    st.regs[r.call(0)] = v.call(1)
+  when 'inc', 'dec'
+    x = v.call(0)
+    x = x && (x + (ins.op == 'inc' ? 1 : -1)) & 0xFF
+    st.regs[r.call(0)] = x; setz(st, x)
+  when 'cpi', 'cp', 'subi', 'sub'
+    x = v.call(0)
+    y = ins.op.end_with?('i') ? imm.call(1) : v.call(1)
+    d = (x && y) ? x - (y & 0xFF) : nil
+    st.c = d && d < 0
+    setz(st, d)
+    st.regs[r.call(0)] = d && d & 0xFF unless ins.op.start_with?('cp')
+  when 'andi', 'ori', 'and', 'or', 'eor'
+    x = v.call(0)
+    y = ins.op.end_with?('i') ? imm.call(1) : v.call(1)
+    res = nil
+    if ins.op == 'eor' && a[0] == a[1]
+      res = 0
+    elsif x && y
+      res = x.send({ 'a' => :&, 'o' => :|, 'e' => :^ }[ins.op[0]], y) & 0xFF
+    end
+    st.regs[r.call(0)] = res; setz(st, res)
+  when 'lsr'
+    x = v.call(0)
+    st.c = x && x.odd?
+    st.regs[r.call(0)] = x && x >> 1; setz(st, x && x >> 1)
+  when 'com'
+    x = v.call(0)
+    st.regs[r.call(0)] = x && ~x & 0xFF
+    st.c = true
+    setz(st, st.regs[r.call(0)])
+  when 'out'
+    kind = (r.call(1) == 1) ? :blank : :pixel
+    st.events << [kind, st.cycles - 1]
+  when 'sbi', 'cbi'
+    bit = imm.call(1)
+    pin = { syms['hsync_pin'] => :hsync, syms['vsync_pin'] => :vsync }[bit]
+    if pin
+      level = (ins.op == 'sbi') ? 'high' : 'low'
+      st.events << [:"#{pin}_#{level}", st.cycles - 2]
+    end
+  when 'ret'
+    return nil
+  when 'rjmp', 'jmp'
+    return target(insns, labels, pc, a[0])
+  when *BRANCHES.keys
+    flag, want = BRANCHES[ins.op]
+    known = st[flag]
+    t = target(insns, labels, pc, a[0])
+    if known.nil?
+      fail_with("backward branch on unknown data: #{ins.line}") if t <= pc
+      return fork(insns, labels, syms, pc, st, pc + 1, 1, t, 2)
+    end
+    taken = (known == want)
+    st.cycles += taken ? 2 : 1
+    return taken ? t : pc + 1
+  when *SKIPS
+    skipsize = TWO_WORD.include?(insns[pc+1].op) ? 2 : 1
+    cond = nil
+    if ins.op.start_with?('sbr')
+      x = v.call(0)
+      bit = imm.call(1)
+      cond = x && ((x >> bit) & 1 == 1) == (ins.op == 'sbrs')
+    end
+    if cond.nil?
+      return fork(insns, labels, syms, pc, st, pc + 1, 1, pc + 2, 1 + skipsize)
+    end
+    st.cycles += cond ? 1 + skipsize : 1
+    return cond ? pc + 2 : pc + 1
+  else
+    # anything else leaves its destination unknown
+    n = a[0] && reg(a[0], syms)
+    st.regs[n] = nil if n
+    st.z = st.c = nil
+  end
+  pc + 1
+end
+
+# Runs the fall-through path of a conditional up to where the taken path
+# lands, then continues with the slower of the two.
+def fork(insns, labels, syms, pc, st, fall, fallcost, join, takencost)
+  a = dup_state(st); a.cycles += fallcost
+  b = dup_state(st); b.cycles += takencost
+  p = fall
+  while p != join
+    fail_with("paths from #{insns[pc].line} never rejoin") if p.nil? || p > join
+    p = step(insns, labels, syms, p, a)
+  end
+  if a.cycles != b.cycles
+    $forks << [insns[pc].line, a.cycles - st.cycles, b.cycles - st.cycles,
+               st.cycles]
+  end
+  merged = (a.cycles >= b.cycles) ? a : b
+  other = (merged.equal?(a)) ? b : a
+  merged.regs.each_index do |k|
+    merged.regs[k] = nil if merged.regs[k] != other.regs[k]
+  end
+  merged.z = nil if merged.z != other.z
+  merged.c = nil if merged.c != other.c
+  st.regs, st.z, st.c = merged.regs, merged.z, merged.c
+  st.cycles, st.events = merged.cycles, merged.events
+  join
+end
+
+def dup_state(st)
+  State.new(st.regs.dup, st.z, st.c, st.cycles, st.events.dup)
+end
+
+st = State.new(Array.new(32), nil, nil, 0, [])
+pc = labels['video_output_frame'].first
+steps = 0
+while pc
+  pc = step(insns, labels, syms, pc, st)
+  steps += 1
+  fail_with('frame never ends') if steps > 10_000_000
+end
+
+# --- report ---
+
+pixel_cycles = syms['pixel_cycles']
+lines = []
+current = nil
+st.events.each do |kind, t|
+  case kind
+  when :hsync_low
+    current = { start: t, pixels: [] }
+    lines << current
+  when :pixel
+    current[:pixels] << t if current
+  when :blank
+    current[:blank] ||= t if current && !current[:pixels].empty?
+  end
+end
+lines.reject! { |l| l[:pixels].empty? }
+
+spacings = Hash.new(0)
+lines.each do |l|
+  l[:pixels].each_cons(2) { |p, q| spacings[q - p] += 1 }
+  spacings[l[:blank] - l[:pixels].last] += 1 if l[:blank]
+end
+scanlines = lines.each_cons(2).map { |p, q| q[:start] - p[:start] }
+active = lines.map { |l| l[:blank] - l[:pixels].first }
+hblank = lines.each_cons(2).map { |p, q| q[:pixels].first - p[:blank] }
+frame = st.cycles
+budget = syms['frame_cycles']
+
+def range(a)
+  a.empty? ? 'n/a' : (a.min == a.max ? a.min.to_s : "#{a.min}-#{a.max}")
+end
+
+ok = true
+puts "  lines: #{lines.length}, " \
+     "pixels per line: #{range(lines.map { |l| l[:pixels].length })}"
+if spacings.keys == [pixel_cycles]
+  puts "  pixel spacing: #{pixel_cycles} cycles (even)"
+else
+  ok = false
+  puts "  pixel spacing: UNEVEN " +
+       spacings.sort.map { |c, n| "#{n}x#{c}" }.join(', ') +
+       " (expected #{pixel_cycles})"
+end
+puts "  active video: #{range(active)} cycles"
+puts "  horizontal blanking: #{range(hblank)} cycles"
+puts "  scanline: #{range(scanlines)} cycles"
+if scanlines.empty? || scanlines.max != syms['line_cycles']
+  ok = false
+  puts "  SCANLINE ISN'T LINE_CYCLES (#{syms['line_cycles']}); " \
+       "recount LINE_OVERHEAD in defs.h"
+end
+puts "  frame: #{frame} of #{budget} cycles, " \
+     "#{budget - frame} left for the main loop"
+if frame > budget
+  ok = false
+  puts "  FRAME OVERRUNS THE FRAME TIMER"
+end
+# a conditional whose paths differ makes pixel timing data-dependent if it
+# runs while pixels are going out
+$forks.group_by { |f| f[0..2] }.each do |(line, x, y), uses|
+  in_video = uses.any? do |f|
+    lines.any? { |l| l[:blank] && f[3] > l[:pixels].first && f[3] < l[:blank] }
+  end
+  if in_video
+    ok = false
+    puts "  UNBALANCED in active video: '#{line}' takes #{x} or #{y} cycles"
+  else
+    puts "  note: '#{line}' takes #{x} or #{y} cycles"
+  end
+end
+
+exit(ok ? 0 : 1)
@@ -13,25 +13,171 @@
 
 #include "video.h"
 #include "defs.h"
+#include "perf.h"
 
 /* an extra row is allocated to mitigate the effects of stupidly writing
  * beyond the end of the screen (try to make this not happen) */
 char TILEMAP[TILES_HIGH+1][TILES_WIDE];
 static int8_t cx;
 static int8_t cy;
-static uint8_t showcursor;
+
+/* The cursor cell is XORed with showcursor. The renderer undoes this on the
+ * off phase of the blink if blinkcursor is 0xFF, so it reads both and the
+ * address of the cursor cell. */
+uint8_t showcursor;
+uint8_t blinkcursor;
+char *cursorcell = &TILEMAP[0][0];
 
 /* Vertical margins */
 static int8_t mtop;
 static int8_t mbottom;
 
+/* last row the terminal uses; the one below it, if any, is a status row */
+static int8_t lastrow = TILES_HIGH-1;
+
 /* reverse video */
 static uint8_t revvideo;
 
+/* Smooth scrolling. While a scroll is in progress the screen starts one row
+ * down in TILEMAP, with the new bottom line in the spare row, and the
+ * renderer starts scrolloffset pixel rows into the first row. TILEMAP is
+ * only shifted when the scroll completes. */
+static uint8_t smoothscroll;
+static uint8_t scrollpending;
+uint8_t scrolloffset;
+#define SCREEN (TILEMAP+scrollpending)
+
+#ifdef FONT_6x8_FULL
+/* With the 256-glyph font a cell is all pattern ID, and reverse video is a
+ * bit per cell here, the leftmost cell in the most significant bit. The
+ * renderer inverts the cells whose bits are set; the cursor flips its
+ * cell's bit. With ATTR_BLINK, each byte is followed by the same cells'
+ * blink bits, and the renderer inverts those cells again on the blink
+ * phase. Rows follow TILEMAP's, spare row and smooth scroll included. */
+uint8_t ATTRMAP[TILES_HIGH+1][ATTR_BYTES][ATTR_PLANES];
+#define REVERSE_PLANE 0
+#define BLINK_PLANE   1
+#define ATTRSCREEN (ATTRMAP+scrollpending)
+#define REVERSE 0xFF
+#define BLANK   0
+#else
+#define REVERSE 0x80
+#define BLANK   revvideo
+#endif
+
+/* The cursor column. After a character in the last column cx is
+ * TILES_WIDE, so the next one wraps; the cursor is shown there, and erases
+ * start there, as if it were still in the last column. */
+#define CURSOR_X ((cx < TILES_WIDE) ? cx : TILES_WIDE-1)
+
+/* Soft glyphs. The table lives in video-asm.S, which aligns it for the
+ * renderer. Pattern IDs softglyph_base to softglyph_base+softglyph_count-1
+ * are drawn from it instead of the font. */
+extern uint8_t SOFTGLYPHS[TILE_HEIGHT][NUM_SOFT_GLYPHS];
+uint8_t softglyph_base;
+uint8_t softglyph_count;
+
+/* The soft glyphs must stay below the first pattern ID with bit 7 set when
+ * that bit means reverse video. With the 256-glyph font, every pattern ID
+ * can be replaced. */
+#ifdef FONT_6x8_FULL
+#define SOFTGLYPH_LIMIT 0x100
+#else
+#define SOFTGLYPH_LIMIT 0x80
+#endif
+
 static void CURSOR_INVERT() __attribute__((noinline));
 static void CURSOR_INVERT()
 {
-  TILEMAP[cy][cx] ^= showcursor;
+#ifdef FONT_6x8_FULL
+  cursorcell = (char *)&ATTRSCREEN[cy][CURSOR_X/8][REVERSE_PLANE];
+  if (showcursor) showcursor = 0x80 >> (CURSOR_X & 7);
+#else
+  cursorcell = &SCREEN[cy][CURSOR_X];
+#endif
+  *cursorcell ^= showcursor;
+}
+
+#ifdef FONT_6x8_FULL
+/* For len cells from (x,y) on, continuing on the following rows, keeps the
+ * bits of one attribute plane that are set in keep, clears the others,
+ * then flips the ones set in flip. Works a byte (eight cells) at a time. */
+static void attr_range(int8_t x, int8_t y, uint16_t len, uint8_t plane,
+                       uint8_t keep, uint8_t flip)
+{
+  uint8_t *a = &ATTRSCREEN[y][x/8][plane];
+  while (len)
+  {
+    uint8_t first = x & 7;
+    uint8_t n = 8-first;
+    uint8_t mask;
+    if (n > TILES_WIDE-x) n = TILES_WIDE-x;
+    if (n > len) n = len;
+    mask = (0xFF >> first) & ~(0xFF >> (first+n));
+    *a = (*a & (keep | ~mask)) ^ (flip & mask);
+    a += ATTR_PLANES; /* past the end of a row, the start of the next */
+    len -= n;
+    x += n;
+    if (x >= TILES_WIDE) x = 0;
+  }
+}
+
+/* Writes a character to a cell, in reverse video if VIDEO_REVERSE is set
+ * in attr or the screen is, and blinking if VIDEO_BLINK is. */
+static void put_cell(int8_t x, int8_t y, char c, uint8_t attr)
+{
+  uint8_t bit = 0x80 >> (x & 7);
+  uint8_t *a = ATTRSCREEN[y][x/8];
+  SCREEN[y][x] = c;
+  if (!revvideo == !(attr & VIDEO_REVERSE))
+    a[REVERSE_PLANE] &= ~bit;
+  else
+    a[REVERSE_PLANE] |= bit;
+#ifdef ATTR_BLINK
+  if (attr & VIDEO_BLINK)
+    a[BLINK_PLANE] |= bit;
+  else
+    a[BLINK_PLANE] &= ~bit;
+#endif
+}
+#else
+/* the reverse video attribute is bit 7 of the character itself */
+#define put_cell(x, y, c, attr) (SCREEN[y][x] = (c) ^ revvideo)
+#endif
+
+/* Erases len cells from (x,y) on, continuing on the following rows. */
+static void blank_cells(int8_t x, int8_t y, uint16_t len)
+{
+  memset(&SCREEN[y][x], BLANK, len);
+#ifdef FONT_6x8_FULL
+  attr_range(x, y, len, REVERSE_PLANE, 0, revvideo);
+#endif
+#ifdef ATTR_BLINK
+  attr_range(x, y, len, BLINK_PLANE, 0, 0);
+#endif
+}
+
+/* Shows len cells from (x,y) on in the screen's reverse video setting,
+ * after they've been written without it. */
+static void set_attrs(int8_t x, int8_t y, uint8_t len)
+{
+#ifdef FONT_6x8_FULL
+  attr_range(x, y, len, REVERSE_PLANE, 0, revvideo);
+#ifdef ATTR_BLINK
+  attr_range(x, y, len, BLINK_PLANE, 0, 0);
+#endif
+#else
+  if (revvideo) video_invert_range(x, y, len);
+#endif
+}
+
+/* Moves n screen rows from row src to row dst. */
+static void move_rows(int8_t dst, int8_t src, uint8_t n)
+{
+  memmove(&SCREEN[dst], &SCREEN[src], n*TILES_WIDE);
+#ifdef FONT_6x8_FULL
+  memmove(&ATTRSCREEN[dst], &ATTRSCREEN[src], n*sizeof(ATTRMAP[0]));
+#endif
 }
 
 void video_welcome()
@@ -51,7 +197,11 @@ void video_welcome()
   video_putcxy(TILES_WIDE-1, 0, '\x0C');
   video_putcxy(0, 2, '\x0E');
   video_putcxy(TILES_WIDE-1, 2, '\x0B');
+#if TILES_WIDE >= 50
   video_putsxy_P(2,1, PSTR("Terminalscope by Matt Sarnoff"));
+#else
+  video_putsxy_P(2,1, PSTR("Terminalscope"));
+#endif
   video_putsxy_P(TILES_WIDE-18, 1, PSTR(VERSION_STRING));
 
   cx = 0;
@@ -71,7 +221,7 @@ void video_setup()
 
   TCCR1A = 0;
   TCCR1B = _BV(WGM12); /* CTC mode */
-  OCR1A = 326;         /* 20000000 / (2*1024*(1+162)) = 59.91 Hz */
+  OCR1A = FRAME_TOP;   /* about 60 Hz; see defs.h */
 
 }
 
@@ -83,6 +233,10 @@ void video_start()
 
 void video_wait()
 {
+  /* the main loop overran if the frame should have started already */
+  if (bit_is_set(TIFR1, OCF1A))
+    perf_late();
+
   /* wait for compare match */
   loop_until_bit_is_set(TIFR1, OCF1A);
   set_bit(TIFR1, OCF1A);
@@ -102,12 +256,38 @@ void video_set_margins(int8_t top, int8_t bottom)
 {
   /* sanitize input */
   if (top < 0) top = 0;
-  if (bottom >= TILES_HIGH) bottom = TILES_HIGH-1;
-  if (top >= bottom) { top = 0; bottom = TILES_HIGH-1; }
+  if (bottom > lastrow) bottom = lastrow;
+  if (top >= bottom) { top = 0; bottom = lastrow; }
 
   mtop = top;
   mbottom = bottom;
-  video_gotoxy(mtop, 0);
+  video_gotoxy(0, mtop);
+}
+
+void video_set_status_row(uint8_t on)
+{
+  video_scroll_finish();
+  CURSOR_INVERT();
+  if (on)
+  {
+    /* scroll the cursor's line up out of the way */
+    if (cy == TILES_HIGH-1)
+    {
+      move_rows(0, 1, TILES_HIGH-1);
+      cy--;
+    }
+    lastrow = TILES_HIGH-2;
+    if (mbottom > lastrow) mbottom = lastrow;
+    if (mtop >= mbottom) { mtop = 0; mbottom = lastrow; }
+  }
+  else
+  {
+    /* a scrolling region that was the whole screen still is */
+    if (mtop == 0 && mbottom == lastrow) mbottom = TILES_HIGH-1;
+    lastrow = TILES_HIGH-1;
+  }
+  blank_cells(0, TILES_HIGH-1, TILES_WIDE);
+  CURSOR_INVERT();
 }
 
 int8_t video_top_margin()
@@ -122,19 +302,65 @@ int8_t video_bottom_margin()
 
 void video_set_reverse(uint8_t val)
 {
-  revvideo = (val) ? 0x80 : 0;
+  revvideo = (val) ? REVERSE : 0;
+}
+
+static void _video_scroll_finish()
+{
+  if (scrollpending)
+  {
+    memmove(TILEMAP, &TILEMAP[1], TILES_HIGH*TILES_WIDE);
+#ifdef FONT_6x8_FULL
+    memmove(ATTRMAP, &ATTRMAP[1], TILES_HIGH*sizeof(ATTRMAP[0]));
+    cursorcell -= sizeof(ATTRMAP[0]);
+#else
+    cursorcell -= TILES_WIDE;
+#endif
+    scrollpending = 0;
+    scrolloffset = 0;
+  }
 }
 
 static void _video_scrollup()
 {
-  memmove(&TILEMAP[mtop], &TILEMAP[mtop+1], (mbottom-mtop)*TILES_WIDE);
-  memset(&TILEMAP[mbottom], revvideo, TILES_WIDE);
+  /* only full-screen scrolls can be smooth; the renderer offsets everything */
+  if (smoothscroll && mtop == 0 && mbottom == TILES_HIGH-1)
+  {
+    _video_scroll_finish();
+    scrollpending = 1;
+    blank_cells(0, mbottom, TILES_WIDE);
+    return;
+  }
+  move_rows(mtop, mtop+1, mbottom-mtop);
+  blank_cells(0, mbottom, TILES_WIDE);
 }
 
 static void _video_scrolldown()
 {
-  memmove(&TILEMAP[mtop+1], &TILEMAP[mtop], (mbottom-mtop)*TILES_WIDE);
-  memset(&TILEMAP[mtop], revvideo, TILES_WIDE);
+  move_rows(mtop+1, mtop, mbottom-mtop);
+  blank_cells(0, mtop, TILES_WIDE);
+}
+
+void video_set_smooth_scroll(uint8_t val)
+{
+  smoothscroll = val;
+  if (!val) video_scroll_finish();
+}
+
+uint8_t video_scrolling()
+{
+  return scrollpending;
+}
+
+void video_scroll_step()
+{
+  if (scrollpending && ++scrolloffset >= TILE_HEIGHT)
+    _video_scroll_finish();
+}
+
+void video_scroll_finish()
+{
+  _video_scroll_finish();
 }
 
 void video_scrollup()
@@ -176,25 +402,28 @@ void video_gotoxy(int8_t x, int8_t y)
   if (cx >= TILES_WIDE) cx = TILES_WIDE-1;
   cy = y;
   if (cy < 0) cy = 0;
-  if (cy >= TILES_HIGH) cy = TILES_HIGH-1;
+  if (cy > lastrow) cy = lastrow;
   CURSOR_INVERT();
 }
 
+/* The sums are worked out in 16 bits; cx+dx can overflow an int8_t */
 void video_movex(int8_t dx)
 {
   CURSOR_INVERT();
-  cx += dx;
-  if (cx < 0) cx = 0;
-  if (cx >= TILES_WIDE) cx = TILES_WIDE-1;
+  int16_t x = cx + dx;
+  if (x < 0) x = 0;
+  if (x >= TILES_WIDE) x = TILES_WIDE-1;
+  cx = x;
   CURSOR_INVERT();
 }
 
 void video_movey(int8_t dy)
 {
   CURSOR_INVERT();
-  cy += dy;
-  if (cy < mtop) cy = mtop;
-  if (cy > mbottom) cy = mbottom;
+  int16_t y = cy + dy;
+  if (y < mtop) y = mtop;
+  if (y > mbottom) y = mbottom;
+  cy = y;
   CURSOR_INVERT();
 }
 
@@ -280,14 +509,15 @@ int8_t video_gety()
 
 char video_charat(int8_t x, int8_t y)
 {
-  return TILEMAP[cy][cx];
+  return SCREEN[cy][cx];
 }
 
 void video_clrscr()
 {
   CURSOR_INVERT();
+  scrollpending = scrolloffset = 0;
   video_reset_margins(); 
-  memset(TILEMAP, revvideo, TILES_WIDE*TILES_HIGH);
+  blank_cells(0, 0, TILES_WIDE*(lastrow+1));
   cx = cy = 0;
   CURSOR_INVERT();
 }
@@ -295,14 +525,14 @@ void video_clrscr()
 void video_clrline()
 {
   CURSOR_INVERT();
-  memset(&TILEMAP[cy], revvideo, TILES_WIDE);
+  blank_cells(0, cy, TILES_WIDE);
   cx = 0;
   CURSOR_INVERT();
 }
 
 void video_clreol()
 {
-  memset(&TILEMAP[cy][cx], revvideo, TILES_WIDE-cx);
+  blank_cells(CURSOR_X, cy, TILES_WIDE-CURSOR_X);
 }
 
 void video_erase(uint8_t erasemode)
@@ -311,14 +541,14 @@ void video_erase(uint8_t erasemode)
   switch(erasemode)
   {
     case 0: /* erase from cursor to end of screen */
-      memset(&TILEMAP[cy][cx], revvideo,
-          (TILES_WIDE*TILES_HIGH)-(cy*TILES_WIDE+cx));
+      blank_cells(CURSOR_X, cy,
+          (TILES_WIDE*(lastrow+1))-(cy*TILES_WIDE+CURSOR_X));
       break;
     case 1: /* erase from beginning of screen to cursor */
-      memset(TILEMAP, revvideo, cy*TILES_WIDE+cx+1);
+      blank_cells(0, 0, cy*TILES_WIDE+CURSOR_X+1);
       break;
     case 2: /* erase entire screen */
-      memset(TILEMAP, revvideo, TILES_WIDE*TILES_HIGH);
+      blank_cells(0, 0, TILES_WIDE*(lastrow+1));
       break;
   }
   CURSOR_INVERT();
@@ -330,13 +560,13 @@ void video_eraseline(uint8_t erasemode)
   switch(erasemode)
   {
     case 0: /* erase from cursor to end of line */
-      memset(&TILEMAP[cy][cx], revvideo, TILES_WIDE-cx);
+      blank_cells(CURSOR_X, cy, TILES_WIDE-CURSOR_X);
       break;
     case 1: /* erase from beginning of line to cursor */
-      memset(&TILEMAP[cy], revvideo, cx+1);
+      blank_cells(0, cy, CURSOR_X+1);
       break;
     case 2: /* erase entire line */
-      memset(&TILEMAP[cy], revvideo, TILES_WIDE);
+      blank_cells(0, cy, TILES_WIDE);
       break;
   }
   CURSOR_INVERT();
@@ -347,7 +577,7 @@ void video_putcxy(int8_t x, int8_t y, char c)
 {
   if (x < 0 || x >= TILES_WIDE) return;
   if (y < 0 || y >= TILES_HIGH) return;
-  TILEMAP[y][x] = c ^ revvideo;
+  put_cell(x, y, c, 0);
 }
 
 /* Does not respect top/bottom margins */
@@ -357,8 +587,8 @@ void video_putsxy(int8_t x, int8_t y, char *str)
   if (y < 0 || y >= TILES_HIGH) return;
   int len = strlen(str);
   if (len > TILES_WIDE-x) len = TILES_WIDE-x;
-  memcpy((char *)(&TILEMAP[y][x]), str, len);
-  if (revvideo) video_invert_range(x, y, len);
+  memcpy((char *)(&SCREEN[y][x]), str, len);
+  set_attrs(x, y, len);
 }
 
 /* Does not respect top/bottom margins */
@@ -368,8 +598,8 @@ void video_putsxy_P(int8_t x, int8_t y, PGM_P str)
   if (y < 0 || y >= TILES_HIGH) return;
   int len = strlen_P(str);
   if (len > TILES_WIDE-x) len = TILES_WIDE-x;
-  memcpy_P((char *)(&TILEMAP[y][x]), str, len);
-  if (revvideo) video_invert_range(x, y, len);
+  memcpy_P((char *)(&SCREEN[y][x]), str, len);
+  set_attrs(x, y, len);
 }
 
 /* Does not respect top/bottom margins */
@@ -377,8 +607,8 @@ void video_putline(int8_t y, char *str)
 {
   if (y < 0 || y >= TILES_HIGH) return;
   /* strncpy fills unused bytes in the destination with nulls */
-  strncpy((char *)(&TILEMAP[y]), str, TILES_WIDE);
-  if (revvideo) video_invert_range(0, y, TILES_WIDE);
+  strncpy((char *)(&SCREEN[y]), str, TILES_WIDE);
+  set_attrs(0, y, TILES_WIDE);
 }
 
 /* Does not respect top/bottom margins */
@@ -386,14 +616,14 @@ void video_putline_P(int8_t y, PGM_P str)
 {
   if (y < 0 || y >= TILES_HIGH) return;
   /* strncpy fills unused bytes in the destination with nulls */
-  strncpy_P((char *)(&TILEMAP[y]), str, TILES_WIDE);
-  if (revvideo) video_invert_range(0, y, TILES_WIDE);
+  strncpy_P((char *)(&SCREEN[y]), str, TILES_WIDE);
+  set_attrs(0, y, TILES_WIDE);
 }
 
 void video_setc(char c)
 {
   CURSOR_INVERT();
-  TILEMAP[cy][cx] = c ^ revvideo;
+  put_cell(CURSOR_X, cy, c, 0);
   CURSOR_INVERT();
 }
 
@@ -407,7 +637,7 @@ static inline void _video_putc(char c)
   else if (c == '\n') _video_lfwd();
   else
   {
-    TILEMAP[cy][cx] = c ^ revvideo;
+    put_cell(cx, cy, c, 0);
     _video_cfwd();
   }
 }
@@ -419,7 +649,16 @@ void video_putc(char c)
   CURSOR_INVERT();
 }
 
+#ifdef FONT_6x8_FULL
 void video_putc_raw(char c)
+{
+  video_putc_raw_attr(c, 0);
+}
+
+void video_putc_raw_attr(char c, uint8_t attr)
+#else
+void video_putc_raw(char c)
+#endif
 {
   CURSOR_INVERT();
   
@@ -427,7 +666,7 @@ void video_putc_raw(char c)
    * we have to go to a new line. */
   if (cx >= TILES_WIDE) _video_lfwd();
   
-  TILEMAP[cy][cx] = c ^ revvideo;
+  put_cell(cx, cy, c, attr);
   _video_cfwd();
   CURSOR_INVERT();
 }
@@ -474,14 +713,47 @@ uint8_t video_cursor_visible()
   return showcursor != 0;
 }
 
+void video_set_cursor_blink(uint8_t val)
+{
+  blinkcursor = (val) ? 0xFF : 0;
+}
+
 void video_invert_range(int8_t x, int8_t y, uint8_t rangelen)
 {
-  char *start = &TILEMAP[y][x];
+#ifdef FONT_6x8_FULL
+  attr_range(x, y, rangelen, REVERSE_PLANE, 0xFF, 0xFF);
+#else
+  char *start = &SCREEN[y][x];
   uint8_t i;
   for (i = 0; i < rangelen; i++)
   {
     *start ^= 0x80;
     start++;
   }
+#endif
 }
 
+void video_softglyphs_on(uint8_t base)
+{
+  if (base > SOFTGLYPH_LIMIT-NUM_SOFT_GLYPHS)
+    base = SOFTGLYPH_LIMIT-NUM_SOFT_GLYPHS;
+  memset(SOFTGLYPHS, 0, sizeof(SOFTGLYPHS));
+  softglyph_base = base;
+  softglyph_count = NUM_SOFT_GLYPHS;
+}
+
+void video_softglyphs_off()
+{
+  softglyph_count = 0;
+}
+
+void video_softglyph_sixel(uint8_t n, uint8_t x, uint8_t y, uint8_t sixel)
+{
+  if (n >= NUM_SOFT_GLYPHS || x >= TILE_WIDTH) return;
+  uint8_t bit = _BV(x);
+  for (; sixel && y < TILE_HEIGHT; sixel >>= 1, y++)
+  {
+    if (sixel & 1)
+      SOFTGLYPHS[y][n] |= bit;
+  }
+}
@@ -14,7 +14,7 @@
 #include <avr/pgmspace.h>
 
 /* Set up video ports and timer parameters. */
-/* Warning: uses TIMER0 */
+/* Warning: uses TIMER1 */
 void video_setup();
 
 /* Start frame timer. The timer fires at roughly 60 Hz. */
@@ -45,6 +45,12 @@ void video_set_margins(int8_t top, int8_t bottom);
  * to the bottom line of the screen. */
 void video_reset_margins();
 
+/* Keeps the bottom line of the screen for a status line, or gives it
+ * back. While it's kept, the cursor, the margins and erasing stay above
+ * it, only the put*xy and putline routines write to it, and scrolling is
+ * never smooth. Either way the line is cleared. */
+void video_set_status_row(uint8_t on);
+
 /* Returns the line number of the top margin. */
 int8_t video_top_margin();
 
@@ -90,6 +96,15 @@ void video_putc(char c);
  * Carriage returns and newlines are not interpreted. */
 void video_putc_raw(char c);
 
+#ifdef FONT_6x8_FULL
+/* Like video_putc_raw(), but with the attributes set in attr. With the
+ * 256-glyph font, characters have no bit to spare for them. VIDEO_BLINK is
+ * ignored unless the build has the blink plane (ATTR_BLINK in defs.h). */
+#define VIDEO_REVERSE 0x80
+#define VIDEO_BLINK   0x40
+void video_putc_raw_attr(char c, uint8_t attr);
+#endif
+
 /* Prints a string at the cursor position and advances the cursor.
  * The screen will be scrolled if necessary. */
 void video_puts(char *str);
@@ -165,6 +180,20 @@ void video_scrollup();
  * A blank lines is added at the top. The cursor is not moved. */
 void video_scrolldown();
 
+/* Enables or disables smooth scrolling. When enabled, scrolling the whole
+ * screen up moves it one pixel row per call to video_scroll_step(). */
+void video_set_smooth_scroll(uint8_t val);
+
+/* Returns 1 if a smooth scroll is in progress. */
+uint8_t video_scrolling();
+
+/* Advances a smooth scroll in progress by one pixel row.
+ * Call this once per frame. */
+void video_scroll_step();
+
+/* Completes a smooth scroll in progress immediately. */
+void video_scroll_finish();
+
 /* Returns the x coordinate of the cursor. */
 int8_t video_getx();
 
@@ -183,6 +212,25 @@ void video_hide_cursor();
 /* Returns 1 if the cursor is visible, 0 if it is hidden. */
 uint8_t video_cursor_visible();
 
+/* Sets whether or not the cursor blinks. Blinking is done by
+ * video_output_frame() and does not modify the tilemap between frames. */
+void video_set_cursor_blink(uint8_t val);
+
 /* Set inverse video for the character range specified. */
 void video_invert_range(int8_t x, int8_t y, uint8_t rangelen);
+
+/****** Soft glyphs ******/
+
+/* Blanks all NUM_SOFT_GLYPHS soft glyphs and displays them in place of the
+ * font patterns starting at the specified pattern ID, moved down if the
+ * glyphs would run past 0x7F (0xFF with the 256-glyph font). Reverse-video
+ * cells show the soft glyphs inverted. */
+void video_softglyphs_on(uint8_t base);
+
+/* Returns to drawing every pattern from the font. */
+void video_softglyphs_off();
+
+/* ORs a sixel (6 vertical pixels, least significant bit on top) into
+ * column x of soft glyph n, with its top pixel at row y. */
+void video_softglyph_sixel(uint8_t n, uint8_t x, uint8_t y, uint8_t sixel);
 #endif